@@ -54,6 +54,35 @@ namespace Angel {
 GLuint InitShader( const char* vertexShaderFile,
 		   const char* fragmentShaderFile );
 
+//  Same as above, with "preamble" (e.g. #defines) inserted into both shaders
+//    right after their #version line
+GLuint InitShader( const char* vertexShaderFile,
+		   const char* fragmentShaderFile,
+		   const char* preamble );
+
+//  Same as above, but return 0 instead of exiting on a read, compile or
+//    link error
+GLuint TryInitShader( const char* vertexShaderFile,
+		      const char* fragmentShaderFile,
+		      const char* preamble );
+
+//  TryInitShader() in two steps, so as not to wait for the driver: start
+//    the compile and link (NULL if a file cannot be read), then, once
+//    ShaderBuildReady(), get the program (0 on an error) and free the build
+struct ShaderBuild;
+ShaderBuild* BeginShaderBuild( const char* vertexShaderFile,
+			       const char* fragmentShaderFile,
+			       const char* preamble );
+bool ShaderBuildReady( const ShaderBuild* build );
+GLuint EndShaderBuild( ShaderBuild* build );
+void DiscardShaderBuild( ShaderBuild* build );  // free it without waiting
+
+//  Whether ShaderBuildReady() can tell, the driver building programs in
+//    threads of its own (GL_KHR/ARB_parallel_shader_compile); without it,
+//    ShaderBuildReady() is always true, and the driver may wait for the
+//    compile in BeginShaderBuild() or EndShaderBuild()
+bool ParallelShaderCompileSupported();
+
 //  Defined constant for when numbers are too small to be used in the
 //    denominator of a division operation.  This is only used if the
 //    DEBUG macro is defined.
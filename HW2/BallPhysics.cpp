@@ -0,0 +1,183 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "BallPhysics.h"
+
+void
+BallPhysics::init(GLfloat x0, GLfloat z0, GLfloat x1, GLfloat z1, GLfloat radius,
+		  const std::vector<vec2>& positions, const std::vector<vec2>& velocities,
+		  const std::vector<quat>& rotations)
+{
+    _count = (int) positions.size();
+    _radius = radius;
+    _x0 = x0; _z0 = z0; _x1 = x1; _z1 = z1;
+
+    _position[0] = _position[1] = positions;
+    _velocity[0] = _velocity[1] = velocities;
+    _rotation = rotations;
+    _current = 0;
+
+    // Cells a diameter wide at least, and about one ball per cell on average
+    // when the balls are small
+    GLfloat width = x1 - x0, depth = z1 - z0;
+    GLfloat cell = std::max( 2.0f * radius, (GLfloat) sqrt( width * depth / std::max( _count, 1 ) ) );
+    _columns = std::max( 1, (int) (width / cell) );
+    _rows = std::max( 1, (int) (depth / cell) );
+    _cellWidth = width / _columns;
+    _cellDepth = depth / _rows;
+
+    _cellStart.assign( _columns * _rows + 1, 0 );
+    _cellBalls.resize( _count );
+    _ballCell.resize( _count );
+
+    _instances.resize( BALL_INSTANCE_ROWS * _count );
+    for ( int i = 0; i < _count; i++ )
+	writeInstance( i );
+    _contacts = 0;
+    _stepMs = 0.0;
+}
+
+int
+BallPhysics::cellOf(const vec2& p) const
+{
+    int column = std::min( std::max( (int) ((p.x - _x0) / _cellWidth), 0 ), _columns - 1 );
+    int row = std::min( std::max( (int) ((p.y - _z0) / _cellDepth), 0 ), _rows - 1 );
+    return row * _columns + column;
+}
+
+// Counting sort of the balls by cell
+void
+BallPhysics::bin()
+{
+    const std::vector<vec2>& position = _position[_current];
+
+    std::fill( _cellStart.begin(), _cellStart.end(), 0 );
+    for ( int i = 0; i < _count; i++ ) {
+	_ballCell[i] = cellOf( position[i] );
+	_cellStart[_ballCell[i] + 1]++;
+    }
+    for ( size_t c = 1; c < _cellStart.size(); c++ )
+	_cellStart[c] += _cellStart[c - 1];
+
+    std::vector<int> next( _cellStart.begin(), _cellStart.end() - 1 );
+    for ( int i = 0; i < _count; i++ )
+	_cellBalls[next[_ballCell[i]]++] = i;
+}
+
+// Step the balls of grid rows [firstRow, endRow); returns the contacts found,
+// each counted by both balls
+int
+BallPhysics::resolveRows(int firstRow, int endRow, GLfloat dt)
+{
+    const std::vector<vec2>& position = _position[_current];
+    const std::vector<vec2>& velocity = _velocity[_current];
+    std::vector<vec2>& newPosition = _position[1 - _current];
+    std::vector<vec2>& newVelocity = _velocity[1 - _current];
+    GLfloat diameter = 2.0 * _radius;
+    int contacts = 0;
+
+    for ( int c = firstRow * _columns; c < endRow * _columns; c++ ) {
+	int column = c % _columns, row = c / _columns;
+
+	for ( int k = _cellStart[c]; k < _cellStart[c + 1]; k++ ) {
+	    int i = _cellBalls[k];
+	    vec2 p = position[i], v = velocity[i];
+	    vec2 push( 0.0, 0.0 ), dv( 0.0, 0.0 );
+	    int touching = 0;
+
+	    // Contacts: each ball of an overlapping pair moves out by half the
+	    // overlap, and they swap the velocity components along the normal
+	    // if approaching (elastic contact, equal masses)
+	    for ( int r = std::max( row - 1, 0 ); r <= std::min( row + 1, _rows - 1 ); r++ )
+		for ( int q = std::max( column - 1, 0 ); q <= std::min( column + 1, _columns - 1 ); q++ ) {
+		    int n = r * _columns + q;
+		    for ( int m = _cellStart[n]; m < _cellStart[n + 1]; m++ ) {
+			int j = _cellBalls[m];
+			vec2 d = p - position[j];
+			GLfloat distance2 = dot( d, d );
+			if ( j == i || distance2 >= diameter * diameter ) { continue; }
+
+			GLfloat distance = sqrt( distance2 );
+			vec2 normal = (distance > 0.0) ? d / distance
+						       : vec2( i < j ? 1.0 : -1.0, 0.0 );
+			push += (diameter - distance) / 2.0 * normal;
+			GLfloat approach = dot( v - velocity[j], normal );
+			if ( approach < 0.0 ) { dv -= approach * normal; }
+			touching++;
+		    }
+		}
+
+	    // All the contacts are resolved at once, from the previous state:
+	    // averaging them keeps a ball in a cluster from gaining speed from
+	    // every neighbour, and the push is capped for deep overlaps
+	    if ( touching > 0 ) {
+		v += dv / touching;
+		GLfloat pushed = length( push );
+		if ( pushed > _radius ) { push *= _radius / pushed; }
+		contacts += touching;
+	    }
+	    p += push + dt * v;
+
+	    // Edges of the floor
+	    if ( p.x < _x0 + _radius ) { p.x = _x0 + _radius; v.x = fabs( v.x ); }
+	    if ( p.x > _x1 - _radius ) { p.x = _x1 - _radius; v.x = -fabs( v.x ); }
+	    if ( p.y < _z0 + _radius ) { p.y = _z0 + _radius; v.y = fabs( v.y ); }
+	    if ( p.y > _z1 - _radius ) { p.y = _z1 - _radius; v.y = -fabs( v.y ); }
+
+	    newPosition[i] = p;
+	    newVelocity[i] = v;
+
+	    // Rolling without slipping: about the horizontal axis across the
+	    // motion, by the distance over the radius
+	    GLfloat speed = length( v );
+	    if ( speed > 0.0 )
+		_rotation[i] = normalize( AxisAngle( speed * dt / _radius / DegreesToRadians,
+						     v.y, 0.0, -v.x ) * _rotation[i] );
+	}
+    }
+    return contacts;
+}
+
+void
+BallPhysics::writeInstance(int i)
+{
+    const vec2& p = _position[_current][i];
+    vec4 translation( p.x, _radius, p.y, 1.0 );
+    mat4 rotation = Rotate( _rotation[i] );
+
+    vec4* rows = &_instances[BALL_INSTANCE_ROWS * i];
+    for ( int row = 0; row < 3; row++ )
+	rows[row] = vec4( _radius * rotation[row][0], _radius * rotation[row][1],
+			  _radius * rotation[row][2], translation[row] );
+
+    const vec2& v = _velocity[_current][i];
+    rows[3] = vec4( v.x, 0.0, v.y, 0.0 );
+}
+
+void
+BallPhysics::step(GLfloat dt, JobSystem& jobs)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    bin();
+
+    // Bands of grid rows, a few per thread to balance uneven bands
+    int bands = std::min( _rows, 4 * jobs.numThreads() );
+    std::atomic<int> contacts( 0 );
+    jobs.run( bands, [&] ( int band ) {
+	contacts += resolveRows( band * _rows / bands, (band + 1) * _rows / bands, dt );
+    } );
+    _current = 1 - _current;
+
+    int chunk = 4096;
+    jobs.run( (_count + chunk - 1) / chunk, [&] ( int part ) {
+	for ( int i = part * chunk; i < std::min( (part + 1) * chunk, _count ); i++ )
+	    writeInstance( i );
+    } );
+
+    _contacts = contacts / 2;
+    _stepMs = std::chrono::duration<double, std::milli>(
+	std::chrono::steady_clock::now() - start ).count();
+}
@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- BallPhysics.h ---
+//
+//   Many balls of one radius rolling on the floor rectangle: they bounce
+//   off its edges and off each other (elastic contacts between equal
+//   masses), and turn as they roll, without slipping.
+//
+//   Each step bins the balls into a uniform grid over the floor whose cells
+//   are at least a diameter wide, so that a ball can only touch balls of
+//   its own and the eight neighbouring cells. The balls are then resolved
+//   band of grid rows by band on a JobSystem: every ball computes its new
+//   state from the previous states of its neighbours and writes only its
+//   own, so the bands need no locking and the result does not depend on the
+//   number of threads.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BALLPHYSICS_H__
+#define __BALLPHYSICS_H__
+
+#include <vector>
+
+#include "Angel-yjc.h"
+#include "Quaternion.h"
+#include "JobSystem.h"
+
+// Rows of each ball in instances(): the first three rows of its model
+// matrix (the fourth is 0 0 0 1), then its motion: velocity (x, 0, z, 0)
+#define BALL_INSTANCE_ROWS  4
+
+class BallPhysics {
+    int         _count;
+    GLfloat     _radius;
+    GLfloat     _x0, _z0, _x1, _z1;      // floor rectangle, in x and z
+
+    // state of each ball: (x, z) position and velocity, before and after
+    // the current step, and rotation
+    std::vector<vec2>  _position[2];
+    std::vector<vec2>  _velocity[2];
+    int                _current;         // index of the latest state
+    std::vector<quat>  _rotation;
+
+    // uniform grid: the balls of cell c are _cellBalls[_cellStart[c]] up to
+    // _cellBalls[_cellStart[c + 1]]
+    int                _columns, _rows;
+    GLfloat            _cellWidth, _cellDepth;
+    std::vector<int>   _cellStart;
+    std::vector<int>   _cellBalls;
+    std::vector<int>   _ballCell;
+
+    std::vector<vec4>  _instances;       // BALL_INSTANCE_ROWS rows of each ball
+
+    int                _contacts;        // of the last step
+    double             _stepMs;
+
+    int  cellOf( const vec2& p ) const;
+    void bin();
+    int  resolveRows( int firstRow, int endRow, GLfloat dt );
+    void writeInstance( int i );
+
+   public:
+    BallPhysics() : _count(0), _radius(1.0), _current(0), _columns(0), _rows(0),
+		    _contacts(0), _stepMs(0.0) {}
+
+    //  Set up the balls of "radius" on the floor [x0, x1] x [z0, z1], with
+    //    (x, z) positions and velocities (per second) and rotations
+    void init( GLfloat x0, GLfloat z0, GLfloat x1, GLfloat z1, GLfloat radius,
+	       const std::vector<vec2>& positions, const std::vector<vec2>& velocities,
+	       const std::vector<quat>& rotations );
+
+    //  Advance by dt seconds, in parallel on "jobs"
+    void step( GLfloat dt, JobSystem& jobs );
+
+    int count() const { return _count; }
+    GLfloat radius() const { return _radius; }
+
+    //  Model matrix and motion of each ball (see BALL_INSTANCE_ROWS):
+    //    BALL_INSTANCE_ROWS * count() rows for an instanced draw
+    const std::vector<vec4>& instances() const { return _instances; }
+
+    //  Contacts resolved and time taken by the last step
+    int contacts() const { return _contacts; }
+    double stepMs() const { return _stepMs; }
+};
+
+#endif // __BALLPHYSICS_H__
@@ -0,0 +1,267 @@
+#include <algorithm>
+
+#include "DynamicBVH.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BVH_SSE
+#endif
+
+void
+DynamicBVH::build(const std::vector<BoundingSphere>& bounds)
+{
+    _spheres = bounds;
+    rebuild();
+}
+
+void
+DynamicBVH::rebuild()
+{
+    int n = (int) _spheres.size();
+
+    _object.resize( n );
+    for ( int i = 0; i < n; i++ )
+	_object[i] = i;
+    _nodes.clear();
+    if ( n > 0 )
+	buildNode( 0, n, -1 );
+
+    // object spheres in slot order
+    _slot.resize( n );
+    _x.assign( n + 3, 0.0 );
+    _y.assign( n + 3, 0.0 );
+    _z.assign( n + 3, 0.0 );
+    _radius.assign( n + 3, 0.0 );
+    for ( int s = 0; s < n; s++ ) {
+	const BoundingSphere& sphere = _spheres[_object[s]];
+	_slot[_object[s]] = s;
+	_x[s] = sphere.center.x;
+	_y[s] = sphere.center.y;
+	_z[s] = sphere.center.z;
+	_radius[s] = sphere.radius;
+    }
+
+    // every box from scratch
+    _leaf.resize( n );
+    for ( int i = 0; i < (int) _nodes.size(); i++ ) {
+	Node& node = _nodes[i];
+	node.low = node.high = vec3( 0.0, 0.0, 0.0 );
+	if ( node.right < 0 )
+	    for ( int s = node.first; s < node.first + node.count; s++ )
+		_leaf[s] = i;
+    }
+    _dirty.assign( _nodes.size(), 1 );
+    _area = 0.0;
+    updateBoxes();
+    _builtArea = _area;
+}
+
+// Build the subtree of the objects at slots first .. first + count - 1
+// below "parent"; returns the index of its root
+int
+DynamicBVH::buildNode(int first, int count, int parent)
+{
+    int index = (int) _nodes.size();
+    Node node;
+    node.first = first;
+    node.count = count;
+    node.right = -1;
+    node.parent = parent;
+    _nodes.push_back( node );
+    if ( count <= BVH_LEAF_SIZE )
+	return index;
+
+    // split at the median of the centers along the longest axis of their box
+    vec3 low = _spheres[_object[first]].center, high = low;
+    for ( int s = first + 1; s < first + count; s++ ) {
+	const vec3& c = _spheres[_object[s]].center;
+	low.x = std::min( low.x, c.x );    high.x = std::max( high.x, c.x );
+	low.y = std::min( low.y, c.y );    high.y = std::max( high.y, c.y );
+	low.z = std::min( low.z, c.z );    high.z = std::max( high.z, c.z );
+    }
+    vec3 size = high - low;
+    int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z) ? 1 : 2;
+
+    int half = count / 2;
+    const std::vector<BoundingSphere>& spheres = _spheres;
+    std::nth_element( _object.begin() + first, _object.begin() + first + half,
+		      _object.begin() + first + count,
+		      [&spheres, axis]( int a, int b ) {
+			  return spheres[a].center[axis] < spheres[b].center[axis];
+		      } );
+
+    buildNode( first, half, index );
+    int right = buildNode( first + half, count - half, index );
+    _nodes[index].right = right;
+    return index;
+}
+
+// Recompute the dirty boxes, children before parents, marking the parent of
+// every box that changed, and keep _area up to date
+void
+DynamicBVH::updateBoxes()
+{
+    for ( int i = (int) _nodes.size() - 1; i >= 0; i-- ) {
+	if ( !_dirty[i] ) { continue; }
+	_dirty[i] = 0;
+
+	Node& node = _nodes[i];
+	vec3 low, high;
+	if ( node.right < 0 ) {
+	    int s = node.first;
+	    low = high = vec3( _x[s], _y[s], _z[s] );
+	    for ( ; s < node.first + node.count; s++ ) {
+		low.x = std::min( low.x, _x[s] - _radius[s] );
+		low.y = std::min( low.y, _y[s] - _radius[s] );
+		low.z = std::min( low.z, _z[s] - _radius[s] );
+		high.x = std::max( high.x, _x[s] + _radius[s] );
+		high.y = std::max( high.y, _y[s] + _radius[s] );
+		high.z = std::max( high.z, _z[s] + _radius[s] );
+	    }
+	}
+	else {
+	    const Node& left = _nodes[i + 1];
+	    const Node& right = _nodes[node.right];
+	    low = vec3( std::min( left.low.x, right.low.x ), std::min( left.low.y, right.low.y ),
+			std::min( left.low.z, right.low.z ) );
+	    high = vec3( std::max( left.high.x, right.high.x ), std::max( left.high.y, right.high.y ),
+			 std::max( left.high.z, right.high.z ) );
+	}
+
+	if ( low.x == node.low.x && low.y == node.low.y && low.z == node.low.z &&
+	     high.x == node.high.x && high.y == node.high.y && high.z == node.high.z )
+	    continue;
+
+	_area += area( low, high ) - area( node.low, node.high );
+	node.low = low;
+	node.high = high;
+	if ( node.parent >= 0 )
+	    _dirty[node.parent] = 1;
+    }
+}
+
+double
+DynamicBVH::area(const vec3& low, const vec3& high)
+{
+    vec3 size = high - low;
+    return 2.0 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void
+DynamicBVH::update(int i, const BoundingSphere& bounds)
+{
+    _spheres[i] = bounds;
+    int s = _slot[i];
+    _x[s] = bounds.center.x;
+    _y[s] = bounds.center.y;
+    _z[s] = bounds.center.z;
+    _radius[s] = bounds.radius;
+    _dirty[_leaf[s]] = 1;
+}
+
+bool
+DynamicBVH::refit()
+{
+    updateBoxes();
+    if ( _area <= BVH_REBUILD_RATIO * _builtArea )
+	return false;
+
+    rebuild();
+    _rebuilds++;
+    return true;
+}
+
+void
+DynamicBVH::cull(const ViewFrustum& frustum, std::vector<int>& visible) const
+{
+    if ( _nodes.empty() ) { return; }
+
+    // planes as structure of arrays, padded to 8 with planes nothing is
+    // outside of
+    float nx[8], ny[8], nz[8], nw[8];
+    for ( int p = 0; p < 8; p++ ) {
+	vec4 plane = (p < 6) ? frustum.plane( p ) : vec4( 0.0, 0.0, 0.0, 1.0e30 );
+	nx[p] = plane.x;  ny[p] = plane.y;  nz[p] = plane.z;  nw[p] = plane.w;
+    }
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while ( top > 0 ) {
+	int index = stack[--top];
+	const Node& node = _nodes[index];
+
+	// box against the planes: outside one, or inside them all
+	vec3 c = 0.5 * (node.low + node.high), e = 0.5 * (node.high - node.low);
+	bool outside = false, inside = true;
+#ifdef BVH_SSE
+	__m128 cx = _mm_set1_ps( c.x ), cy = _mm_set1_ps( c.y ), cz = _mm_set1_ps( c.z );
+	__m128 ex = _mm_set1_ps( e.x ), ey = _mm_set1_ps( e.y ), ez = _mm_set1_ps( e.z );
+	__m128 signMask = _mm_set1_ps( -0.0f );
+	for ( int p = 0; p < 8; p += 4 ) {
+	    __m128 px = _mm_loadu_ps( nx + p ), py = _mm_loadu_ps( ny + p );
+	    __m128 pz = _mm_loadu_ps( nz + p ), pw = _mm_loadu_ps( nw + p );
+	    __m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, cx ), _mm_mul_ps( py, cy ) ),
+				   _mm_add_ps( _mm_mul_ps( pz, cz ), pw ) );
+	    __m128 r = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_andnot_ps( signMask, px ), ex ),
+					       _mm_mul_ps( _mm_andnot_ps( signMask, py ), ey ) ),
+				   _mm_mul_ps( _mm_andnot_ps( signMask, pz ), ez ) );
+	    outside |= _mm_movemask_ps( _mm_cmplt_ps( _mm_add_ps( d, r ), _mm_setzero_ps() ) ) != 0;
+	    inside &= _mm_movemask_ps( _mm_cmpge_ps( d, r ) ) == 0xF;
+	}
+#else
+	for ( int p = 0; p < 6; p++ ) {
+	    GLfloat d = nx[p] * c.x + ny[p] * c.y + nz[p] * c.z + nw[p];
+	    GLfloat r = fabs( nx[p] ) * e.x + fabs( ny[p] ) * e.y + fabs( nz[p] ) * e.z;
+	    outside |= d + r < 0.0;
+	    inside &= d >= r;
+	}
+#endif
+	if ( outside ) { continue; }
+
+	if ( inside ) {
+	    visible.insert( visible.end(), _object.begin() + node.first,
+			    _object.begin() + node.first + node.count );
+	    continue;
+	}
+
+	if ( node.right >= 0 ) {
+	    stack[top++] = node.right;
+	    stack[top++] = index + 1;
+	    continue;
+	}
+
+	// leaf across a plane: its spheres, four at a time
+	for ( int s = node.first; s < node.first + node.count; s += 4 ) {
+	    int lanes = std::min( 4, node.first + node.count - s );
+#ifdef BVH_SSE
+	    __m128 x = _mm_loadu_ps( &_x[s] ), y = _mm_loadu_ps( &_y[s] );
+	    __m128 z = _mm_loadu_ps( &_z[s] );
+	    __m128 minusRadius = _mm_sub_ps( _mm_setzero_ps(), _mm_loadu_ps( &_radius[s] ) );
+	    __m128 out = _mm_setzero_ps();
+	    for ( int p = 0; p < 6; p++ ) {
+		// summed in the order of ViewFrustum::intersects(), for the same
+		// result on spheres touching a plane
+		__m128 d = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( nx[p] ), x ),
+				       _mm_mul_ps( _mm_set1_ps( ny[p] ), y ) );
+		d = _mm_add_ps( _mm_add_ps( d, _mm_mul_ps( _mm_set1_ps( nz[p] ), z ) ),
+				_mm_set1_ps( nw[p] ) );
+		out = _mm_or_ps( out, _mm_cmplt_ps( d, minusRadius ) );
+	    }
+	    int in = ~_mm_movemask_ps( out ) & ((1 << lanes) - 1);
+#else
+	    int in = 0;
+	    for ( int k = 0; k < lanes; k++ ) {
+		bool out = false;
+		for ( int p = 0; p < 6; p++ )
+		    out |= nx[p] * _x[s + k] + ny[p] * _y[s + k] + nz[p] * _z[s + k] + nw[p]
+			   < -_radius[s + k];
+		if ( !out ) in |= 1 << k;
+	    }
+#endif
+	    for ( int k = 0; k < lanes; k++ )
+		if ( in & (1 << k) )
+		    visible.push_back( _object[s + k] );
+	}
+    }
+}
@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- DynamicBVH.h ---
+//
+//   Bounding volume hierarchy over the bounding spheres of many moving
+//   objects, for view frustum culling in time that grows with what is
+//   visible rather than with the number of objects.
+//
+//   The tree is a binary tree of axis-aligned boxes built top down, each
+//   node split at the median of its objects along its longest axis, with
+//   up to BVH_LEAF_SIZE objects per leaf. When objects move, update() only
+//   marks their leaves and refit() grows or shrinks the boxes from those
+//   leaves up to the root, keeping the tree's shape. A refit tree gets
+//   looser as objects drift away from the neighbours they were built with;
+//   once the total surface area of its boxes exceeds BVH_REBUILD_RATIO
+//   times that of the last build, refit() rebuilds it.
+//
+//   cull() walks the tree from the root: a box outside a frustum plane is
+//   skipped with its subtree, a box inside all the planes is accepted
+//   whole, and the spheres of a leaf are tested four at a time. The plane
+//   tests use SSE when available (four planes at a time for a box).
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DYNAMICBVH_H__
+#define __DYNAMICBVH_H__
+
+#include <vector>
+
+#include "Angel-yjc.h"
+#include "ViewFrustum.h"
+
+#define BVH_LEAF_SIZE       8      // objects per leaf, at most
+#define BVH_REBUILD_RATIO   1.5    // surface area growth that triggers a rebuild
+
+class DynamicBVH {
+    struct Node {
+	vec3    low, high;      // box
+	int     first, count;   // its objects: slots first .. first + count - 1
+	int     right;          // right child, the left one being the next node;
+	                        //   -1 for a leaf
+	int     parent;         // -1 for the root
+    };
+
+    std::vector<Node>       _nodes;     // depth first: children after their parent
+    std::vector<char>       _dirty;     // node box to be recomputed by refit()
+
+    // The objects of a subtree have consecutive slots. Object spheres by
+    // slot (structure of arrays, padded by 3 so that four can always be
+    // loaded), the object and leaf at each slot and the slot of each object
+    std::vector<BoundingSphere> _spheres;   // by object
+    std::vector<int>        _object;
+    std::vector<int>        _leaf;
+    std::vector<int>        _slot;
+    std::vector<GLfloat>    _x, _y, _z, _radius;
+
+    double                  _area;      // total surface area of the boxes
+    double                  _builtArea; //   right after the last build
+    int                     _rebuilds;
+
+    void rebuild();
+    int  buildNode( int first, int count, int parent );
+    void updateBoxes();
+    static double area( const vec3& low, const vec3& high );
+
+  public:
+    DynamicBVH() : _area(0.0), _builtArea(0.0), _rebuilds(0) {}
+
+    //  Build the tree over the spheres; object i is bounds[i]
+    void build( const std::vector<BoundingSphere>& bounds );
+
+    //  Object i has moved to "bounds"; the tree is brought up to date by
+    //    the next refit()
+    void update( int i, const BoundingSphere& bounds );
+
+    //  Refit the boxes of the moved objects, or rebuild the tree if it has
+    //    become too loose; true if it was rebuilt
+    bool refit();
+
+    //  Append to "visible" the objects whose spheres are not entirely
+    //    outside the frustum, in tree order
+    void cull( const ViewFrustum& frustum, std::vector<int>& visible ) const;
+
+    int count() const { return (int) _slot.size(); }
+    int numNodes() const { return (int) _nodes.size(); }
+    int rebuilds() const { return _rebuilds; }
+
+    //  Surface area of the boxes relative to the last build (>= 1 looser)
+    double looseness() const { return (_builtArea > 0.0) ? _area / _builtArea : 1.0; }
+};
+
+#endif // __DYNAMICBVH_H__
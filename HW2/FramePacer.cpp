@@ -0,0 +1,85 @@
+#include <math.h>
+
+#include "FramePacer.h"
+
+void
+FramePacer::setTargetRate(double fps)
+{
+    _interval = fps > 0.0 ? 1.0 / fps : 0.0;
+    _scheduled = false;
+}
+
+int
+FramePacer::delayMs()
+{
+    Clock::time_point now = Clock::now();
+
+    if ( _interval <= 0.0 ) { return 0; }
+
+    Clock::duration interval = std::chrono::duration_cast<Clock::duration>(
+	std::chrono::duration<double>( _interval ) );
+    if ( !_scheduled ) {
+	_deadline = now;
+	_scheduled = true;
+       }
+    _deadline += interval;
+    if ( _deadline < now ) {  // late: restart the schedule from now
+	_deadline = now;
+	return 0;
+       }
+    return (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+	_deadline - now ).count();
+}
+
+void
+FramePacer::reset()
+{
+    _scheduled = false;
+    _measuring = false;
+}
+
+void
+FramePacer::framePresented(double swapSeconds)
+{
+    Clock::time_point now = Clock::now();
+
+    if ( !_measuring ) {
+	_measuring = true;
+	_windowStart = now;
+	_windowCpu = std::clock();
+	_intervals.clear();
+	_swapSeconds = 0.0;
+       }
+    else
+	_intervals.push_back( std::chrono::duration<double>( now - _lastFrame ).count() );
+
+    _lastFrame = now;
+    _swapSeconds += swapSeconds;
+}
+
+bool
+FramePacer::report(PacingReport& report)
+{
+    if ( !_measuring || _intervals.empty() ) { return false; }
+
+    double wall = std::chrono::duration<double>( _lastFrame - _windowStart ).count();
+    if ( wall < 1.0 ) { return false; }
+
+    double sum = 0.0, sumSquares = 0.0;
+    for ( size_t i = 0; i < _intervals.size(); i++ ) {
+	sum += _intervals[i];
+	sumSquares += _intervals[i] * _intervals[i];
+    }
+    double n = (double) _intervals.size();
+    double mean = sum / n;
+    double variance = sumSquares / n - mean * mean;
+
+    report.fps = n / wall;
+    report.intervalMs = 1000.0 * mean;
+    report.jitterMs = 1000.0 * sqrt( variance > 0.0 ? variance : 0.0 );
+    report.cpuPercent = 100.0 * (std::clock() - _windowCpu) / CLOCKS_PER_SEC / wall;
+    report.vsync = _swapSeconds > 0.5 * sum;
+
+    _measuring = false;  // the next frame starts a new window
+    return true;
+}
@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- FramePacer.h ---
+//
+//   Frame pacing for the animation. Frames are due at a fixed target rate;
+//   delayMs() tells how long to sleep (e.g. with glutTimerFunc) until the
+//   next one instead of rendering in a busy loop. A frame that is late
+//   moves the schedule instead of being followed by a burst of catch-up
+//   frames.
+//
+//   Presented frames are measured over one-second windows: achieved rate,
+//   mean interval and its jitter (standard deviation), process CPU
+//   utilization, and whether the buffer swap blocks for most of a frame,
+//   i.e. vsync is pacing the frames.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRAMEPACER_H__
+#define __FRAMEPACER_H__
+
+#include <chrono>
+#include <ctime>
+#include <vector>
+
+struct PacingReport {
+    double  fps;              // frames presented per second
+    double  intervalMs;       // mean time between presented frames
+    double  jitterMs;         // standard deviation of that time
+    double  cpuPercent;       // process CPU time / wall time (all threads)
+    bool    vsync;            // the swap blocks for most of a frame
+};
+
+class FramePacer {
+    typedef std::chrono::steady_clock Clock;
+
+    double              _interval;      // target seconds per frame, 0: unlimited
+    Clock::time_point   _deadline;      // when the next frame is due
+    bool                _scheduled;     // _deadline is meaningful
+
+    // measurement window
+    Clock::time_point   _windowStart;
+    std::clock_t        _windowCpu;
+    Clock::time_point   _lastFrame;
+    bool                _measuring;
+    std::vector<double> _intervals;     // seconds between presented frames
+    double              _swapSeconds;   // total time blocked in swaps
+
+   public:
+    FramePacer() : _interval(1.0 / 60.0), _scheduled(false), _measuring(false),
+		   _swapSeconds(0.0) {}
+
+    //  Target frames per second; 0 renders as fast as possible
+    void setTargetRate( double fps );
+    double targetRate() const { return _interval > 0.0 ? 1.0 / _interval : 0.0; }
+
+    //  Milliseconds to wait before the next frame, which is then due
+    int delayMs();
+
+    //  Forget the schedule and the measurements, e.g. when pausing
+    void reset();
+
+    //  Record a presented frame, with the time spent in the buffer swap
+    void framePresented( double swapSeconds );
+
+    //  Once per second of measurement: fill "report" and start a new window
+    bool report( PacingReport& report );
+};
+
+#endif // __FRAMEPACER_H__
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "FrameTimer.h"
+
+void
+FrameTimer::init()
+{
+    // GL_TIME_ELAPSED queries are core in 3.3; check that they count
+    GLint bits = 0;
+    while ( glGetError() != GL_NO_ERROR ) {}  // errors left by earlier calls
+    glGetQueryiv( GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits );
+    while ( glGetError() != GL_NO_ERROR ) { bits = 0; }
+    _gpu = bits > 0;
+
+    if ( _gpu )
+	glGenQueries( TIMER_QUERY_FRAMES * TIMER_MAX_SECTIONS, &_queries[0][0] );
+    else
+	printf( "GL_TIME_ELAPSED not supported: GPU times are not measured\n" );
+
+    for ( int set = 0; set < TIMER_QUERY_FRAMES; set++ )
+	_pendingValid[set] = false;
+}
+
+// Move the frame that used query set "set" into the ring buffer
+void
+FrameTimer::resolve(int set)
+{
+    if ( !_pendingValid[set] ) { return; }
+
+    FrameTiming& timing = _pending[set];
+    for ( int i = 0; i < timing.numSections; i++ ) {
+	timing.gpuMs[i] = -1.0;
+	if ( !_gpu ) { continue; }
+
+	GLint available = 0;
+	glGetQueryObjectiv( _queries[set][i], GL_QUERY_RESULT_AVAILABLE, &available );
+	if ( available ) {
+	    GLuint64 ns;
+	    glGetQueryObjectui64v( _queries[set][i], GL_QUERY_RESULT, &ns );
+	    timing.gpuMs[i] = ns / 1.0e6;
+	   }
+    }
+
+    _history[_count % TIMER_HISTORY] = timing;
+    _count++;
+    _pendingValid[set] = false;
+}
+
+void
+FrameTimer::beginFrame()
+{
+    int set = _frame % TIMER_QUERY_FRAMES;
+    resolve( set );
+
+    _pending[set].frame = _frame;
+    _pending[set].numSections = 0;
+    _pendingValid[set] = true;
+    _frame++;
+}
+
+void
+FrameTimer::begin(const char* name)
+{
+    int set = (_frame - 1) % TIMER_QUERY_FRAMES;
+    FrameTiming& timing = _pending[set];
+    if ( _open >= 0 || timing.numSections == TIMER_MAX_SECTIONS ) { return; }
+
+    _open = timing.numSections++;
+    strncpy( timing.name[_open], name, TIMER_NAME_LENGTH - 1 );
+    timing.name[_open][TIMER_NAME_LENGTH - 1] = '\0';
+
+    if ( _gpu ) glBeginQuery( GL_TIME_ELAPSED, _queries[set][_open] );
+    _start = std::chrono::steady_clock::now();
+}
+
+void
+FrameTimer::end()
+{
+    if ( _open < 0 ) { return; }
+
+    int set = (_frame - 1) % TIMER_QUERY_FRAMES;
+    _pending[set].cpuMs[_open] = std::chrono::duration<double, std::milli>(
+	std::chrono::steady_clock::now() - _start ).count();
+    if ( _gpu ) glEndQuery( GL_TIME_ELAPSED );
+    _open = -1;
+}
+
+const FrameTiming&
+FrameTimer::frame(int i) const
+{
+    int first = _count < TIMER_HISTORY ? 0 : _count - TIMER_HISTORY;
+    return _history[(first + i) % TIMER_HISTORY];
+}
+
+bool
+FrameTimer::writeCsv(const char* path) const
+{
+    FILE* file = fopen( path, "w" );
+    if ( file == NULL ) {
+	printf( "Unable to write %s\n", path );
+	return false;
+    }
+
+    fprintf( file, "frame,section,cpu_ms,gpu_ms\n" );
+    for ( int i = 0; i < numFrames(); i++ ) {
+	const FrameTiming& timing = frame( i );
+	for ( int j = 0; j < timing.numSections; j++ )
+	    fprintf( file, "%d,%s,%.4f,%.4f\n", timing.frame, timing.name[j],
+		     timing.cpuMs[j], timing.gpuMs[j] );
+    }
+
+    fclose( file );
+    return true;
+}
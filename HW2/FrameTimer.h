@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- FrameTimer.h ---
+//
+//   CPU and GPU timing of the sections of a frame. Each section is timed
+//   with std::chrono on the CPU and a GL_TIME_ELAPSED query on the GPU.
+//   The queries of a frame are read TIMER_QUERY_FRAMES frames later, when
+//   they are normally available, so reading them never stalls; a result
+//   still not available then is recorded as -1. Finished frames go into a
+//   ring buffer of the last TIMER_HISTORY frames.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRAMETIMER_H__
+#define __FRAMETIMER_H__
+
+#include <chrono>
+
+#include "Angel-yjc.h"
+
+#define TIMER_QUERY_FRAMES    3    // sets of queries in flight
+#define TIMER_MAX_SECTIONS   16    // sections per frame
+#define TIMER_HISTORY       512    // frames kept in the ring buffer
+#define TIMER_NAME_LENGTH    32
+
+struct FrameTiming {
+    int     frame;                                   // frame number
+    int     numSections;
+    char    name[TIMER_MAX_SECTIONS][TIMER_NAME_LENGTH];
+    double  cpuMs[TIMER_MAX_SECTIONS];
+    double  gpuMs[TIMER_MAX_SECTIONS];               // -1 if unknown
+};
+
+class FrameTimer {
+    bool         _gpu;                               // GL_TIME_ELAPSED supported
+    GLuint       _queries[TIMER_QUERY_FRAMES][TIMER_MAX_SECTIONS];
+    FrameTiming  _pending[TIMER_QUERY_FRAMES];       // frames waiting for their queries
+    bool         _pendingValid[TIMER_QUERY_FRAMES];
+    int          _frame;
+    int          _open;                              // section being timed, -1 if none
+    std::chrono::steady_clock::time_point  _start;
+
+    FrameTiming  _history[TIMER_HISTORY];
+    int          _count;                             // frames in the ring buffer
+
+    void resolve( int set );
+
+   public:
+    FrameTimer() : _gpu(false), _frame(0), _open(-1), _count(0) {}
+
+    //  Create the queries; needs a current GL context
+    void init();
+
+    //  Start a frame, reading the queries of the frame that used this set
+    void beginFrame();
+    void begin( const char* name );
+    void end();
+
+    //  Finished frames, oldest first; i < numFrames()
+    int numFrames() const { return _count < TIMER_HISTORY ? _count : TIMER_HISTORY; }
+    const FrameTiming& frame( int i ) const;
+
+    //  Write the ring buffer as "frame,section,cpu_ms,gpu_ms" lines
+    bool writeCsv( const char* path ) const;
+};
+
+#endif // __FRAMETIMER_H__
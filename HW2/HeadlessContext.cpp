@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <vector>
+
+#include "Angel-yjc.h"
+#include "HeadlessContext.h"
+
+#ifdef HAVE_EGL
+#  include <EGL/egl.h>
+#  include <EGL/eglext.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint framebuffer = 0;
+static GLuint renderbuffers[2];
+
+bool
+CreateHeadlessContext(int width, int height)
+{
+    // Prefer the surfaceless platform, which needs no X server or device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+	(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if ( getPlatformDisplay )
+	display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+#endif
+    if ( display == EGL_NO_DISPLAY )
+	display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+    EGLint major, minor;
+    if ( display == EGL_NO_DISPLAY || !eglInitialize( display, &major, &minor ) ) {
+	printf( "Headless: unable to initialize EGL\n" );
+	return false;
+    }
+    if ( !eglBindAPI( EGL_OPENGL_API ) ) {
+	printf( "Headless: EGL %d.%d has no desktop OpenGL\n", major, minor );
+	return false;
+    }
+
+    // Same GL version as the window; no config is needed without a surface
+    EGLint attributes[] = {
+	EGL_CONTEXT_MAJOR_VERSION, 3,
+	EGL_CONTEXT_MINOR_VERSION, 2,
+	EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+	EGL_NONE
+    };
+    context = eglCreateContext( display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes );
+    if ( context == EGL_NO_CONTEXT
+	 || !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) ) {
+	printf( "Headless: unable to create a surfaceless OpenGL 3.2 context\n" );
+	return false;
+    }
+
+    // GLEW resolves its entry points through the current (EGL) context. A
+    // GLX build of GLEW then fails to find a GLX display, after having
+    // loaded the GL functions, which is all that is needed here.
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if ( err == GLEW_ERROR_NO_GLX_DISPLAY ) { err = GLEW_OK; }
+#endif
+    if ( err != GLEW_OK ) {
+	printf( "Headless: glewInit failed: %s\n", (char*) glewGetErrorString( err ) );
+	return false;
+    }
+    while ( glGetError() != GL_NO_ERROR ) {}  // glewInit may leave an error
+
+    glGenFramebuffers( 1, &framebuffer );
+    glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+    glGenRenderbuffers( 2, renderbuffers );
+    glBindRenderbuffer( GL_RENDERBUFFER, renderbuffers[0] );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width, height );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_RENDERBUFFER, renderbuffers[0] );
+    glBindRenderbuffer( GL_RENDERBUFFER, renderbuffers[1] );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+			       GL_RENDERBUFFER, renderbuffers[1] );
+
+    if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE ) {
+	printf( "Headless: %dx%d framebuffer incomplete\n", width, height );
+	return false;
+    }
+    return true;
+}
+
+void
+DestroyHeadlessContext()
+{
+    if ( context == EGL_NO_CONTEXT ) { return; }
+
+    glDeleteFramebuffers( 1, &framebuffer );
+    glDeleteRenderbuffers( 2, renderbuffers );
+    eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+    eglDestroyContext( display, context );
+    eglTerminate( display );
+    context = EGL_NO_CONTEXT;
+}
+
+#else // !HAVE_EGL
+
+bool
+CreateHeadlessContext(int width, int height)
+{
+    printf( "Headless: this program was built without EGL\n" );
+    return false;
+}
+
+void
+DestroyHeadlessContext()
+{
+}
+
+#endif // HAVE_EGL
+
+bool
+SaveFramebufferPPM(const char* path, int width, int height)
+{
+    std::vector<unsigned char> pixels( width * height * 3 );
+    glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+    glReadPixels( 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0] );
+
+    FILE* file = fopen( path, "wb" );
+    if ( file == NULL ) {
+	printf( "Unable to write %s\n", path );
+	return false;
+    }
+
+    // PPM rows run top to bottom, GL rows bottom to top
+    fprintf( file, "P6\n%d %d\n255\n", width, height );
+    for ( int y = height - 1; y >= 0; y-- )
+	fwrite( &pixels[y * width * 3], 1, width * 3, file );
+    fclose( file );
+    return true;
+}
@@ -0,0 +1,28 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- HeadlessContext.h ---
+//
+//   Offscreen rendering without a window, for benchmarks and CI hosts with
+//   no display or GPU. An EGL context is created on Mesa's surfaceless
+//   platform (software rendering through llvmpipe works) and a framebuffer
+//   object of the requested size is bound in place of the window, so that
+//   the usual display() draws into it unchanged.
+//
+//   EGL is only used when the program is built with HAVE_EGL (see
+//   CMakeLists.txt); otherwise CreateHeadlessContext() fails.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __HEADLESSCONTEXT_H__
+#define __HEADLESSCONTEXT_H__
+
+//  Create and make current a GL context with a width x height color and
+//    depth/stencil framebuffer. Returns false (with a message) on failure.
+bool CreateHeadlessContext( int width, int height );
+
+void DestroyHeadlessContext();
+
+//  Write the color buffer of the current framebuffer to a binary PPM file
+bool SaveFramebufferPPM( const char* path, int width, int height );
+
+#endif // __HEADLESSCONTEXT_H__
@@ -1,10 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <chrono>
+#include <mutex>
+#include <string>
 
 #include "Angel-yjc.h"
 
 namespace Angel {
 
+// Directory where linked program binaries are cached between runs, one file
+// per program and driver, named <program>-<driver>-<sources>.bin after the
+// hashes of the shader file names and preamble, of the driver and of the
+// shader sources
+#define SHADER_CACHE_DIR  "shadercache"
+
+// Header written in front of each cached program binary
+struct ProgramCacheHeader {
+    char      magic[4];     // "RBPC"
+    uint64_t  sourceHash;   // hash of both shader sources and the preamble
+    uint64_t  driverHash;   // hash of GL_RENDERER and GL_VERSION
+    GLenum    format;       // binary format returned by glGetProgramBinary
+    GLint     length;       // size of the binary following the header
+    double    compileMs;    // time the source compile + link took
+};
+
+// Cache statistics, printed with every cache hit (programs may be built on
+// more than one thread, see ShaderBuilder.h)
+static int    cacheHits = 0;
+static double cacheSavedMs = 0.0;
+static std::mutex cacheStatsMutex;
+
 // Create a NULL-terminated string by reading the provided file
 static char*
 readShaderSource(const char* shaderFile)
@@ -35,10 +64,176 @@ readShaderSource(const char* shaderFile)
     return buf;
 }
 
+// 64-bit FNV-1a hash of a NULL-terminated string, continuing from "h"
+static uint64_t
+hashString(uint64_t h, const char* str)
+{
+    for ( ; *str != '\0'; str++ ) {
+	h ^= (unsigned char) *str;
+	h *= 1099511628211ULL;
+    }
+    return h;
+}
 
-// Create a GLSL program object from vertex and fragment shader files
-GLuint
-InitShader(const char* vShaderFile, const char* fShaderFile)
+// Whether the driver can return program binaries at all
+static bool
+programBinarySupported()
+{
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+    GLint numFormats = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats );
+    return numFormats > 0;
+#else
+    return false;
+#endif
+}
+
+// Try to load "program" from the cache file "path". Fails if the file is
+// missing, was written for different sources or a different driver, or
+// the driver rejects the binary.
+static bool
+loadProgramBinary(GLuint program, const std::string& path,
+		  uint64_t sourceHash, uint64_t driverHash, double* compileMs)
+{
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if ( fp == NULL ) { return false; }
+
+    ProgramCacheHeader header;
+    bool ok = fread( &header, sizeof(header), 1, fp ) == 1
+	      && memcmp( header.magic, "RBPC", 4 ) == 0
+	      && header.sourceHash == sourceHash
+	      && header.driverHash == driverHash
+	      && header.length > 0;
+
+    char* binary = NULL;
+    if ( ok ) {
+	binary = new char[header.length];
+	ok = fread( binary, 1, header.length, fp ) == (size_t) header.length;
+       }
+    fclose( fp );
+
+    if ( ok ) {
+	glProgramBinary( program, header.format, binary, header.length );
+	GLint linked;
+	glGetProgramiv( program, GL_LINK_STATUS, &linked );
+	ok = linked != 0;
+	*compileMs = header.compileMs;
+       }
+    delete [] binary;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+// Write the binary of the linked "program" to the cache file "path"
+static void
+saveProgramBinary(GLuint program, const std::string& path,
+		  uint64_t sourceHash, uint64_t driverHash, double compileMs)
+{
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+    ProgramCacheHeader header;
+    memset( &header, 0, sizeof(header) );  // no uninitialized padding on disk
+    memcpy( header.magic, "RBPC", 4 );
+    header.sourceHash = sourceHash;
+    header.driverHash = driverHash;
+    header.compileMs = compileMs;
+
+    glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &header.length );
+    if ( header.length <= 0 ) { return; }
+    char* binary = new char[header.length];
+    glGetProgramBinary( program, header.length, NULL, &header.format, binary );
+
+    mkdir( SHADER_CACHE_DIR, 0755 );
+    FILE* fp = fopen( path.c_str(), "wb" );
+    if ( fp != NULL ) {
+	fwrite( &header, sizeof(header), 1, fp );
+	fwrite( binary, 1, header.length, fp );
+	fclose( fp );
+       }
+    else printf("Cannot write shader cache file %s\n", path.c_str());
+
+    delete [] binary;
+#endif
+}
+
+// Delete the cache files of the same program and driver as "path" (the same
+// name up to the source hash) but other sources: they were written before
+// the shaders were edited and will never be loaded again
+static void
+pruneProgramBinaries(const std::string& path)
+{
+    std::string name = path.substr( path.rfind( '/' ) + 1 );
+    std::string prefix = name.substr( 0, name.rfind( '-' ) + 1 );
+
+    DIR* dir = opendir( SHADER_CACHE_DIR );
+    if ( dir == NULL ) { return; }
+    struct dirent* entry;
+    while ( (entry = readdir( dir )) != NULL ) {
+	if ( strncmp( entry->d_name, prefix.c_str(), prefix.size() ) == 0
+	     && name != entry->d_name ) {
+	    std::string stale = std::string( SHADER_CACHE_DIR "/" ) + entry->d_name;
+	    if ( remove( stale.c_str() ) == 0 )
+		printf("Removed stale shader cache file %s\n", stale.c_str());
+	   }
+       }
+    closedir( dir );
+}
+
+// Detach from "program" and delete the shader objects "shaders" (0 for none)
+static void
+releaseShaders(GLuint program, const GLuint shaders[2])
+{
+    for ( int i = 0; i < 2; ++i ) {
+	if ( shaders[i] == 0 ) { continue; }
+	GLint attached = 0;
+	GLuint ids[2];
+	glGetAttachedShaders( program, 2, &attached, ids );
+	for ( int j = 0; j < attached; ++j )
+	    if ( ids[j] == shaders[i] ) { glDetachShader( program, shaders[i] ); }
+	glDeleteShader( shaders[i] );
+       }
+}
+
+
+// Whether the driver compiles and links in threads of its own and can be
+// asked if it is done (GL_KHR/ARB_parallel_shader_compile)
+bool
+ParallelShaderCompileSupported()
+{
+    static int supported = -1;
+    if ( supported < 0 ) {
+	supported = 0;
+	GLint numExtensions = 0;
+	glGetIntegerv( GL_NUM_EXTENSIONS, &numExtensions );
+	for ( GLint i = 0; i < numExtensions; i++ ) {
+	    const char* name = (const char*) glGetStringi( GL_EXTENSIONS, i );
+	    if ( strcmp( name, "GL_KHR_parallel_shader_compile" ) == 0 ||
+		 strcmp( name, "GL_ARB_parallel_shader_compile" ) == 0 )
+		supported = 1;
+	   }
+       }
+    return supported == 1;
+}
+
+// A program being built, from BeginShaderBuild() to EndShaderBuild()
+struct ShaderBuild {
+    GLuint       program;
+    GLuint       shaders[2];    // 0 for a program loaded from the cache
+    std::string  filenames[2];
+    bool         cached;        // loaded from the binary cache, already linked
+    std::string  cacheFile;
+    uint64_t     sourceHash, driverHash;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Start building a GLSL program object from vertex and fragment shader
+// files with "preamble" inserted after their #version line, through the
+// binary cache. The compile and link are only issued: their errors are
+// checked by EndShaderBuild(). NULL if a file cannot be read.
+ShaderBuild*
+BeginShaderBuild(const char* vShaderFile, const char* fShaderFile, const char* preamble)
 {
     struct Shader {
 	const char*  filename;
@@ -49,47 +244,157 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	{ fShaderFile, GL_FRAGMENT_SHADER, NULL }
     };
 
-    GLuint program = glCreateProgram();
-    
     for ( int i = 0; i < 2; ++i ) {
 	Shader& s = shaders[i];
 	s.source = readShaderSource( s.filename );
 	if ( shaders[i].source == NULL ) {
 	    std::cerr << "Failed to read " << s.filename << std::endl;
-	    exit( EXIT_FAILURE );	
+	    delete [] shaders[0].source;
+	    return NULL;
 	   }
         else printf("Successfully read %s\n", s.filename);
+    }
+
+    ShaderBuild* build = new ShaderBuild;
+    build->filenames[0] = vShaderFile;
+    build->filenames[1] = fShaderFile;
+    build->shaders[0] = build->shaders[1] = 0;
+    build->cached = false;
+
+    /* look for a cached binary of the same sources built by the same driver */
+    bool useCache = programBinarySupported();
+    build->sourceHash = 14695981039346656037ULL;
+    build->sourceHash = hashString( build->sourceHash, shaders[0].source );
+    build->sourceHash = hashString( build->sourceHash, shaders[1].source );
+    build->sourceHash = hashString( build->sourceHash, (preamble == NULL) ? "" : preamble );
+    build->driverHash = 14695981039346656037ULL;
+    build->driverHash = hashString( build->driverHash, (const char*) glGetString(GL_RENDERER) );
+    build->driverHash = hashString( build->driverHash, (const char*) glGetString(GL_VERSION) );
+
+    uint64_t programHash = 14695981039346656037ULL;
+    programHash = hashString( programHash, vShaderFile );
+    programHash = hashString( programHash, fShaderFile );
+    programHash = hashString( programHash, (preamble == NULL) ? "" : preamble );
+
+    char cacheFile[128];
+    snprintf( cacheFile, sizeof(cacheFile), "%s/%016llx-%016llx-%016llx.bin",
+	      SHADER_CACHE_DIR, (unsigned long long) programHash,
+	      (unsigned long long) build->driverHash, (unsigned long long) build->sourceHash );
+    if ( useCache ) { build->cacheFile = cacheFile; }
+
+    build->program = glCreateProgram();
 
-	GLuint shader = glCreateShader( s.type );
-	glShaderSource( shader, 1, (const GLchar**) &s.source, NULL );
+    if ( useCache ) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double compileMs;
+	if ( loadProgramBinary( build->program, cacheFile, build->sourceHash, build->driverHash,
+				&compileMs ) ) {
+	    double loadMs = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start ).count();
+	    std::lock_guard<std::mutex> lock( cacheStatsMutex );
+	    cacheHits++;
+	    cacheSavedMs += compileMs - loadMs;
+	    printf("Shader cache hit %s: loaded in %.2f ms instead of %.2f ms "
+		   "(%d hits, %.1f ms saved)\n\n",
+		   cacheFile, loadMs, compileMs, cacheHits, cacheSavedMs);
+	    delete [] shaders[0].source;
+	    delete [] shaders[1].source;
+	    build->cached = true;
+	    return build;
+	   }
+	glDeleteProgram( build->program );
+	build->program = glCreateProgram();
+	printf("Shader cache miss %s\n", cacheFile);
+#ifdef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	// must be set before linking for glGetProgramBinary() to work
+	glProgramParameteri( build->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+#endif
+       }
+
+    build->start = std::chrono::steady_clock::now();
+
+    for ( int i = 0; i < 2; ++i ) {
+	Shader& s = shaders[i];
+
+	// Split the source after the #version line, which must stay first
+	const GLchar* strings[3];
+	GLint lengths[3];
+	const char* version = strstr( s.source, "#version" );
+	while ( version != NULL && version != s.source && version[-1] != '\n' )
+	    version = strstr( version + 1, "#version" ); // skip it in comments
+	const char* body = s.source;
+	if ( version != NULL ) {
+	    body = strchr( version, '\n' );
+	    body = (body == NULL) ? version + strlen(version) : body + 1;
+	   }
+	strings[0] = s.source;  lengths[0] = (GLint) (body - s.source);
+	strings[1] = (preamble == NULL) ? "" : preamble;  lengths[1] = -1;
+	strings[2] = body;      lengths[2] = -1;
+
+	GLuint shader = build->shaders[i] = glCreateShader( s.type );
+	glShaderSource( shader, 3, strings, lengths );
 	glCompileShader( shader );
+	delete [] s.source;
+
+	glAttachShader( build->program, shader );
+    }
+
+    /* link; a shader that failed to compile fails the link */
+    glLinkProgram( build->program );
+
+    return build;
+}
+
+
+// Whether the driver has finished compiling and linking the program of
+// "build"; always true if it cannot tell (see ParallelShaderCompileSupported())
+bool
+ShaderBuildReady(const ShaderBuild* build)
+{
+#ifdef GL_COMPLETION_STATUS_KHR
+    if ( build->cached || !ParallelShaderCompileSupported() ) { return true; }
+    GLint done = GL_FALSE;
+    glGetProgramiv( build->program, GL_COMPLETION_STATUS_KHR, &done );
+    return done == GL_TRUE;
+#else
+    return true;
+#endif
+}
 
+
+// Finish "build", waiting for the driver if needed, and delete it. Returns
+// its program, or 0 after printing the errors if it failed to compile or
+// link; exits instead if "exitOnError" is set.
+static GLuint
+endShaderBuild(ShaderBuild* build, bool exitOnError)
+{
+    GLuint program = build->program;
+    if ( build->cached ) {
+	delete build;
+	return program;
+       }
+
+    bool ok = true;
+    for ( int i = 0; i < 2; ++i ) {
 	GLint  compiled;
-	glGetShaderiv( shader, GL_COMPILE_STATUS, &compiled );
+	glGetShaderiv( build->shaders[i], GL_COMPILE_STATUS, &compiled );
 	if ( !compiled ) {
-	    std::cerr << s.filename << " failed to compile:" << std::endl;
+	    std::cerr << build->filenames[i] << " failed to compile:" << std::endl;
 	    GLint  logSize;
-	    glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &logSize );
+	    glGetShaderiv( build->shaders[i], GL_INFO_LOG_LENGTH, &logSize );
 	    char* logMsg = new char[logSize];
-	    glGetShaderInfoLog( shader, logSize, NULL, logMsg );
+	    glGetShaderInfoLog( build->shaders[i], logSize, NULL, logMsg );
 	    std::cerr << logMsg << std::endl;
 	    delete [] logMsg;
-
-	    exit( EXIT_FAILURE );
+	    ok = false;
 	   }
-        else printf("Successfully compiled %s\n", s.filename);
-
-	delete [] s.source;
-
-	glAttachShader( program, shader );
+        else printf("Successfully compiled %s\n", build->filenames[i].c_str());
     }
 
-    /* link and error check */
-    glLinkProgram(program);
-
+    /* link error check */
     GLint  linked;
     glGetProgramiv( program, GL_LINK_STATUS, &linked );
-    if ( !linked ) {
+    if ( ok && !linked ) {
 	std::cerr << "Shader program failed to link" << std::endl;
 	GLint  logSize;
 	glGetProgramiv( program, GL_INFO_LOG_LENGTH, &logSize);
@@ -97,10 +402,25 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	glGetProgramInfoLog( program, logSize, NULL, logMsg );
 	std::cerr << logMsg << std::endl;
 	delete [] logMsg;
+	ok = false;
+    }
+    releaseShaders( program, build->shaders );  // the program keeps what it needs
 
-	exit( EXIT_FAILURE );
+    if ( !ok ) {
+	if ( exitOnError ) { exit( EXIT_FAILURE ); }
+	glDeleteProgram( program );
+	delete build;
+	return 0;
     }
-    else printf("Successfully linked program object\n\n");
+    printf("Successfully linked program object\n\n");
+
+    if ( !build->cacheFile.empty() ) {
+	double compileMs = std::chrono::duration<double, std::milli>(
+			       std::chrono::steady_clock::now() - build->start ).count();
+	saveProgramBinary( program, build->cacheFile, build->sourceHash, build->driverHash,
+			   compileMs );
+	pruneProgramBinaries( build->cacheFile );
+       }
 
 #if 0 /* YJC: Do NOT use this program obj yet!
               Call glUseProgram() outside, in suitable places inside display(),
@@ -110,7 +430,67 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
     glUseProgram(program);
 #endif
 
+    delete build;
     return program;
 }
 
+GLuint
+EndShaderBuild(ShaderBuild* build)
+{
+    return endShaderBuild(build, false);
+}
+
+// Delete "build" and its program, finished or not, without checking them
+void
+DiscardShaderBuild(ShaderBuild* build)
+{
+    if ( !build->cached ) { releaseShaders( build->program, build->shaders ); }
+    glDeleteProgram( build->program );
+    delete build;
+}
+
+
+// Build a GLSL program object from vertex and fragment shader files with
+// "preamble" inserted after their #version line, waiting for it.
+// On error, exit if "exitOnError" is set and return 0 otherwise.
+static GLuint
+buildProgram(const char* vShaderFile, const char* fShaderFile, const char* preamble,
+	     bool exitOnError)
+{
+    ShaderBuild* build = BeginShaderBuild( vShaderFile, fShaderFile, preamble );
+    if ( build == NULL ) {
+	if ( exitOnError ) { exit( EXIT_FAILURE ); }
+	return 0;
+       }
+    return endShaderBuild( build, exitOnError );
+}
+
+
+// Create a GLSL program object from vertex and fragment shader files
+GLuint
+InitShader(const char* vShaderFile, const char* fShaderFile)
+{
+    return InitShader(vShaderFile, fShaderFile, NULL);
+}
+
+
+// Create a GLSL program object from vertex and fragment shader files,
+// inserting "preamble" (e.g. a list of #defines) into both shaders right
+// after their #version line. A NULL preamble is the same as "".
+GLuint
+InitShader(const char* vShaderFile, const char* fShaderFile, const char* preamble)
+{
+    return buildProgram(vShaderFile, fShaderFile, preamble, true);
+}
+
+
+// Same as InitShader(), but return 0 instead of exiting the program if the
+// shaders cannot be read, compiled or linked (e.g. when reloading shaders
+// that are being edited)
+GLuint
+TryInitShader(const char* vShaderFile, const char* fShaderFile, const char* preamble)
+{
+    return buildProgram(vShaderFile, fShaderFile, preamble, false);
+}
+
 }  // Close namespace Angel block
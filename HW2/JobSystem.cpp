@@ -0,0 +1,81 @@
+#include "JobSystem.h"
+
+JobSystem::~JobSystem()
+{
+    {
+	std::lock_guard<std::mutex> lock( _mutex );
+	_quit = true;
+    }
+    _wake.notify_all();
+    for ( size_t i = 0; i < _workers.size(); i++ )
+	_workers[i].join();
+}
+
+void
+JobSystem::start(int threads)
+{
+    if ( threads <= 0 )
+	threads = (int) std::thread::hardware_concurrency() - 1;
+    for ( int i = (int) _workers.size(); i < threads; i++ )
+	_workers.push_back( std::thread( &JobSystem::worker, this ) );
+}
+
+// Take jobs of the current run until there are none left
+void
+JobSystem::work()
+{
+    int i;
+    while ( (i = _next.fetch_add( 1 )) < _count ) {
+	(*_job)( i );
+	if ( _pending.fetch_sub( 1 ) == 1 ) {
+	    std::lock_guard<std::mutex> lock( _mutex );
+	    _done.notify_all();
+	}
+    }
+}
+
+void
+JobSystem::worker()
+{
+    unsigned seen = 0;
+    while ( true ) {
+	{
+	    std::unique_lock<std::mutex> lock( _mutex );
+	    _wake.wait( lock, [&] { return _quit || _generation != seen; } );
+	    if ( _quit ) { return; }
+	    seen = _generation;
+
+	    // Too late for this run: its jobs have all been handed out, and
+	    // run() may return, or start the next run, at any time
+	    if ( _next >= _count ) { continue; }
+	    _busy++;
+	}
+
+	work();
+
+	std::lock_guard<std::mutex> lock( _mutex );
+	if ( --_busy == 0 ) { _done.notify_all(); }
+    }
+}
+
+void
+JobSystem::run(int count, const std::function<void(int)>& job)
+{
+    if ( count <= 0 ) { return; }
+    {
+	std::lock_guard<std::mutex> lock( _mutex );
+	_job = &job;
+	_count = count;
+	_pending = count;
+	_next = 0;
+	_generation++;
+    }
+    _wake.notify_all();
+
+    work();
+
+    // Also wait for the workers to leave work(), so that none of them can
+    // pick up a job of the next run before it is set up
+    std::unique_lock<std::mutex> lock( _mutex );
+    _done.wait( lock, [&] { return _pending == 0 && _busy == 0; } );
+}
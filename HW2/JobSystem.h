@@ -0,0 +1,55 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- JobSystem.h ---
+//
+//   A fixed pool of worker threads for data-parallel work: run(count, job)
+//   calls job(0) .. job(count - 1) spread over the workers and the calling
+//   thread, and returns once they have all finished. Jobs are handed out
+//   one at a time from a shared counter, so uneven jobs balance out; more
+//   jobs than threads helps with that.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __JOBSYSTEM_H__
+#define __JOBSYSTEM_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+    std::vector<std::thread>  _workers;
+    std::mutex                _mutex;
+    std::condition_variable   _wake;      // a new run, or quit
+    std::condition_variable   _done;      // the run has finished
+
+    const std::function<void(int)>*  _job;
+    int                       _count;
+    std::atomic<int>          _next;      // next job to hand out
+    std::atomic<int>          _pending;   // jobs not finished yet
+    int                       _busy;      // workers taking part in the run
+    unsigned                  _generation;
+    bool                      _quit;
+
+    void work();
+    void worker();
+
+   public:
+    JobSystem() : _job(NULL), _count(0), _next(0), _pending(0), _busy(0),
+		  _generation(0), _quit(false) {}
+    ~JobSystem();
+
+    //  Start "threads" workers; 0 for one per hardware thread but the caller's
+    void start( int threads = 0 );
+
+    //  Threads that run jobs, the calling one included
+    int numThreads() const { return (int) _workers.size() + 1; }
+
+    //  Run job(0) .. job(count - 1) and wait for them; one run at a time
+    void run( int count, const std::function<void(int)>& job );
+};
+
+#endif // __JOBSYSTEM_H__
@@ -0,0 +1,85 @@
+#include "PlanarShadow.h"
+
+void
+PlanarShadow::setLight(const vec4& light)
+{
+    if ( light.x == _light.x && light.y == _light.y &&
+	 light.z == _light.z && light.w == _light.w )
+	return;
+
+    _light = light;
+    for ( size_t i = 0; i < _receivers.size(); i++ )
+	_receivers[i].dirty = true;
+}
+
+int
+PlanarShadow::addPlane(const vec4& plane)
+{
+    Receiver receiver;
+    receiver.plane = plane;
+    receiver.dirty = true;
+    _receivers.push_back( receiver );
+    return (int) _receivers.size() - 1;
+}
+
+void
+PlanarShadow::setPlane(int i, const vec4& plane)
+{
+    Receiver& receiver = _receivers[i];
+    if ( plane.x == receiver.plane.x && plane.y == receiver.plane.y &&
+	 plane.z == receiver.plane.z && plane.w == receiver.plane.w )
+	return;
+
+    receiver.plane = plane;
+    receiver.dirty = true;
+}
+
+const mat4&
+PlanarShadow::matrix(int i)
+{
+    Receiver& receiver = _receivers[i];
+    if ( receiver.dirty ) {
+	const vec4& P = receiver.plane;
+	const vec4& L = _light;
+	GLfloat d = dot( P, L );
+
+	// row r of d I - L P^T
+	for ( int r = 0; r < 4; r++ ) {
+	    receiver.matrix[r] = -L[r] * P;
+	    receiver.matrix[r][r] += d;
+	}
+	receiver.dirty = false;
+    }
+    return receiver.matrix;
+}
+
+bool
+PlanarShadow::shadowBounds(int i, const BoundingSphere& caster, BoundingSphere& shadow)
+{
+    const vec4& P = _receivers[i].plane;
+    if ( _light.w == 0.0 )
+	return false;
+
+    // heights above the plane, on the light's side
+    GLfloat norm = length( vec3( P.x, P.y, P.z ) );
+    GLfloat lightHeight = dot( P, _light ) / norm;
+    GLfloat height = dot( P, vec4( caster.center, 1.0 ) ) / norm;
+    if ( lightHeight < 0.0 ) {
+	lightHeight = -lightHeight;
+	height = -height;
+    }
+    if ( height + caster.radius >= lightHeight )
+	return false;
+
+    // A caster point at height h lands at L + (p - L) k, k = lightHeight /
+    // (lightHeight - h); over the sphere k ranges from kLow to kHigh, so it
+    // lands within r kHigh + |c - L| (kHigh - kLow) of the center's shadow
+    GLfloat kHigh = lightHeight / (lightHeight - height - caster.radius);
+    GLfloat kLow = lightHeight / (lightHeight - height + caster.radius);
+    vec3 light( _light.x, _light.y, _light.z );
+    vec4 center = matrix( i ) * vec4( caster.center, 1.0 );
+
+    shadow.center = vec3( center.x, center.y, center.z ) / center.w;
+    shadow.radius = caster.radius * kHigh + length( caster.center - light ) * (kHigh - kLow);
+    return true;
+}
@@ -0,0 +1,57 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- PlanarShadow.h ---
+//
+//   Projection of objects onto receiving planes from a point light: the
+//   matrix that flattens a shadow caster onto the plane a x + b y + c z +
+//   d = 0, seen from the light at L,
+//
+//     M = (P . L) I - L P^T,      P = (a, b, c, d)
+//
+//   A point p lands at M p, where the line from L through p meets the plane
+//   (after the divide by w). It follows the light and the planes: a matrix
+//   is recomputed, on demand, only after the light or its plane changed.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __PLANARSHADOW_H__
+#define __PLANARSHADOW_H__
+
+#include <vector>
+
+#include "Angel-yjc.h"
+#include "ViewFrustum.h"
+
+class PlanarShadow {
+    struct Receiver {
+	vec4    plane;      // (a, b, c, d)
+	mat4    matrix;     // projection onto the plane
+	bool    dirty;      // matrix out of date
+    };
+
+    vec4                  _light;
+    std::vector<Receiver>   _receivers;
+
+  public:
+    PlanarShadow() : _light(0.0, 1.0, 0.0, 1.0) {}
+
+    //  The light position (w = 1), or direction towards the light (w = 0)
+    void setLight( const vec4& light );
+    const vec4& light() const { return _light; }
+
+    //  Add the receiving plane a x + b y + c z + d = 0; its index
+    int addPlane( const vec4& plane );
+    void setPlane( int i, const vec4& plane );
+    int numPlanes() const { return (int) _receivers.size(); }
+    const vec4& plane( int i ) const { return _receivers[i].plane; }
+
+    //  The projection onto plane i, recomputed if the light or plane moved
+    const mat4& matrix( int i );
+
+    //  A sphere bounding the shadow on plane i of the caster inside
+    //    "caster"; false if there is none (the caster reaches the light's
+    //    side of the plane, or the light is directional)
+    bool shadowBounds( int i, const BoundingSphere& caster, BoundingSphere& shadow );
+};
+
+#endif // __PLANARSHADOW_H__
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Quaternion.h ---
+//
+//   Unit quaternions for accumulating rotations: composing two costs 16
+//   multiplications instead of 64 for mat4, and renormalizing keeps the
+//   result a pure rotation however many are composed. Rotate(q) converts
+//   to a matrix once it is needed. Angles are in degrees, as in Rotate().
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __QUATERNION_H__
+#define __QUATERNION_H__
+
+#include "Angel-yjc.h"
+
+struct quat {
+    GLfloat w, x, y, z;    // w + xi + yj + zk
+
+    //  The identity rotation
+    quat() : w(1.0), x(0.0), y(0.0), z(0.0) {}
+
+    quat( GLfloat w, GLfloat x, GLfloat y, GLfloat z )
+	: w(w), x(x), y(y), z(z) {}
+
+    //  The rotation by "this" after "q", as for matrices
+    quat operator * ( const quat& q ) const {
+	return quat( w*q.w - x*q.x - y*q.y - z*q.z,
+		     w*q.x + x*q.w + y*q.z - z*q.y,
+		     w*q.y - x*q.z + y*q.w + z*q.x,
+		     w*q.z + x*q.y - y*q.x + z*q.w );
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  The rotation by "angle" degrees about (x, y, z), of any non-zero length
+//
+
+inline
+quat AxisAngle( const GLfloat angle, const GLfloat x, const GLfloat y, const GLfloat z )
+{
+    GLfloat len = sqrt( x*x + y*y + z*z );
+    GLfloat half = angle * DegreesToRadians / 2.0;
+    GLfloat s = sin( half ) / len;
+    return quat( cos( half ), x * s, y * s, z * s );
+}
+
+//----------------------------------------------------------------------------
+
+inline
+quat normalize( const quat& q )
+{
+    GLfloat len = sqrt( q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z );
+    return quat( q.w / len, q.x / len, q.y / len, q.z / len );
+}
+
+//----------------------------------------------------------------------------
+//
+//  The rotation of unit quaternion q as an angle in degrees, in [0, 360),
+//  about a unit axis
+//
+
+inline
+void ToAxisAngle( const quat& q, double& angle, vec3& axis )
+{
+    double sine = sqrt( (double) q.x*q.x + (double) q.y*q.y + (double) q.z*q.z );
+    angle = 2.0 * atan2( sine, (double) q.w ) * 180.0 / M_PI;
+    if ( sine > 0.0 )
+	axis = vec3( q.x / sine, q.y / sine, q.z / sine );
+    else
+	axis = vec3( 1.0, 0.0, 0.0 );
+}
+
+//----------------------------------------------------------------------------
+//
+//  The rotation matrix of unit quaternion q (row order, as Rotate())
+//
+
+inline
+mat4 Rotate( const quat& q )
+{
+    GLfloat xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+    GLfloat xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+    GLfloat wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+    mat4 c;
+    c[0] = vec4( 1.0 - 2.0*(yy + zz), 2.0*(xy - wz), 2.0*(xz + wy), 0.0 );
+    c[1] = vec4( 2.0*(xy + wz), 1.0 - 2.0*(xx + zz), 2.0*(yz - wx), 0.0 );
+    c[2] = vec4( 2.0*(xz - wy), 2.0*(yz + wx), 1.0 - 2.0*(xx + yy), 0.0 );
+    return c;
+}
+
+#endif // __QUATERNION_H__
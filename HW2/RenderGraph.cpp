@@ -0,0 +1,89 @@
+#include "RenderGraph.h"
+
+int
+RenderGraph::addPass(const RenderPassDesc& pass)
+{
+    _passes.push_back( pass );
+    _draws.push_back( 0 );
+    return (int) _passes.size() - 1;
+}
+
+static bool
+sameState(const RenderPassDesc& a, const RenderPassDesc& b)
+{
+    return a.depthTest == b.depthTest && a.depthMask == b.depthMask
+	&& a.colorMask == b.colorMask && a.stencil == b.stencil;
+}
+
+void
+RenderGraph::beginFrame()
+{
+    for ( size_t i = 0; i < _draws.size(); i++ )
+	_draws[i] = 0;
+    _presented = 0;
+}
+
+void
+RenderGraph::compile()
+{
+    int n = (int) _passes.size();
+
+    /*--- Cull: walk back from the presented resources ---*/
+    std::vector<bool> live( n, false );
+    unsigned needed = _presented;
+    bool grown = true;
+    while ( grown ) {
+	grown = false;
+	for ( int i = n - 1; i >= 0; i-- ) {
+	    if ( live[i] || _draws[i] == 0 || !(_passes[i].outputs & needed) )
+		continue;
+	    live[i] = true;
+	    needed |= _passes[i].inputs;
+	    grown = true;
+	   }
+    }
+
+    /*--- Order: repeatedly take the first live pass whose producers are done ---*/
+    std::vector<int> order;
+    std::vector<bool> done( n, false );
+    for ( int count = 0; count < n; count++ ) {
+	int next = -1;
+	for ( int i = 0; i < n && next < 0; i++ ) {
+	    if ( !live[i] || done[i] ) continue;
+	    unsigned reads = _passes[i].inputs | _passes[i].afterInputs;
+	    bool ready = true;
+	    for ( int j = 0; j < n; j++ )
+		if ( j != i && live[j] && !done[j] && (_passes[j].outputs & reads) )
+		    ready = false;
+	    if ( ready ) next = i;
+	   }
+	if ( next < 0 ) break;  // nothing left (or a cycle: the rest is dropped)
+	done[next] = true;
+	order.push_back( next );
+    }
+
+    /*--- Merge neighbours with equal state that do not depend on each other ---*/
+    _slotOf.assign( n, -1 );
+    _slotPass.clear();
+    _slotName.clear();
+    unsigned slotOutputs = 0;
+    for ( size_t k = 0; k < order.size(); k++ ) {
+	const RenderPassDesc& pass = _passes[order[k]];
+	bool merge = false;
+	if ( !_slotPass.empty() ) {
+	    const RenderPassDesc& head = _passes[_slotPass.back()];
+	    merge = sameState( head, pass ) && !((pass.inputs | pass.afterInputs) & slotOutputs);
+	   }
+	if ( merge ) {
+	    _slotName.back() += std::string( "+" ) + pass.name;
+	    slotOutputs |= pass.outputs;
+	   }
+	else {
+	    _slotPass.push_back( order[k] );
+	    _slotName.push_back( pass.name );
+	    slotOutputs = pass.outputs;
+	   }
+	_slotOf[order[k]] = (int) _slotPass.size() - 1;
+    }
+
+}
@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RenderGraph.h ---
+//
+//   A small declarative render graph. Passes are declared once with the
+//   logical resources they read and write and the depth/color writes they
+//   need; every frame the graph is compiled into a schedule:
+//
+//   - passes with no draws, and passes whose outputs are neither presented
+//     nor read by another live pass, are dropped;
+//   - the remaining passes are ordered so that each runs after the passes
+//     producing its inputs (declaration order breaks ties);
+//   - consecutive passes with the same state that do not depend on each
+//     other are merged into one slot, so that their draws sort together.
+//
+//   The slot of each pass replaces the pass field of the render queue sort
+//   keys.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RENDERGRAPH_H__
+#define __RENDERGRAPH_H__
+
+#include <string>
+#include <vector>
+
+#include "Angel-yjc.h"
+
+//  Stencil use of a pass
+enum {
+    STENCIL_OFF,     // no stencil test
+    STENCIL_MARK,    // write 1 wherever the pass draws
+    STENCIL_ONCE,    // draw only where 1, and clear it so each pixel is drawn once
+};
+
+struct RenderPassDesc {
+    const char*  name;
+    unsigned     inputs;          // resources read; keep their producers alive
+    unsigned     afterInputs;     // resources that, if produced this frame,
+                                  //   must be complete first (ordering only)
+    unsigned     outputs;         // resources written
+    GLboolean    depthTest;
+    GLboolean    depthMask;       // depth writes
+    GLboolean    colorMask;       // color writes
+    int          stencil;         // STENCIL_*
+};
+
+class RenderGraph {
+    std::vector<RenderPassDesc>  _passes;
+    std::vector<int>             _draws;     // draws submitted per pass this frame
+    unsigned                     _presented; // resources shown at the end of the frame
+
+    std::vector<int>             _slotOf;    // slot of each pass, -1 if dropped
+    std::vector<int>             _slotPass;  // first pass of each slot (its state)
+    std::vector<std::string>     _slotName;
+
+   public:
+    RenderGraph() : _presented(0) {}
+
+    //  Declare a pass; returns its id
+    int addPass( const RenderPassDesc& pass );
+
+    //  Per frame: reset, count the draws of each pass, choose the resources
+    //    to present, then compile
+    void beginFrame();
+    void addDraw( int pass ) { _draws[pass]++; }
+    void present( unsigned resources ) { _presented = resources; }
+    void compile();
+
+    //  Compiled schedule
+    int numSlots() const { return (int) _slotPass.size(); }
+    int slot( int pass ) const { return _slotOf[pass]; }
+    const std::vector<int>& slots() const { return _slotOf; }
+    const RenderPassDesc& slotState( int slot ) const { return _passes[_slotPass[slot]]; }
+    const char* slotName( int slot ) const { return _slotName[slot].c_str(); }
+};
+
+#endif // __RENDERGRAPH_H__
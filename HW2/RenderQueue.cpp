@@ -0,0 +1,47 @@
+#include <string.h>
+#include <algorithm>
+
+#include "RenderQueue.h"
+
+uint64_t
+MakeSortKey(unsigned pass, unsigned program, bool blend, GLenum polygonMode, GLfloat depth)
+{
+    // The bits of a non-negative float compare in the same order as the float
+    if ( depth < 0.0 ) { depth = 0.0; }
+    uint32_t depthBits;
+    memcpy( &depthBits, &depth, sizeof(depthBits) );
+    if ( blend ) { depthBits = ~depthBits; }
+
+    return ((uint64_t) (pass & 0xF) << 60)
+	 | ((uint64_t) (program & 0xFFFF) << 44)
+	 | ((uint64_t) (blend ? 1 : 0) << 43)
+	 | ((uint64_t) (polygonMode == GL_LINE ? 1 : 0) << 42)
+	 | (uint64_t) depthBits;
+}
+
+void
+RenderQueue::remapPasses(const std::vector<int>& slots)
+{
+    size_t kept = 0;
+    for ( size_t i = 0; i < _commands.size(); i++ ) {
+	int slot = slots[SortKeyPass( _commands[i].key )];
+	if ( slot < 0 ) { continue; }
+	_commands[kept] = _commands[i];
+	_commands[kept].key = (_commands[kept].key & ~((uint64_t) 0xF << 60))
+			    | ((uint64_t) (slot & 0xF) << 60);
+	kept++;
+    }
+    _commands.resize( kept );
+}
+
+static bool
+keyLess(const DrawCommand& a, const DrawCommand& b)
+{
+    return a.key < b.key;
+}
+
+void
+RenderQueue::sort()
+{
+    std::stable_sort( _commands.begin(), _commands.end(), keyLess );
+}
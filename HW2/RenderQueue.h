@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RenderQueue.h ---
+//
+//   Draws are pushed to a queue with a 64-bit sort key, then sorted and
+//   executed, so that draws sharing program and render state run together
+//   regardless of the order in which they were submitted.
+//
+//   Sort key layout, most significant field first:
+//     bits 60-63  pass              (passes always run in increasing order;
+//                                    see RenderQueue::remapPasses())
+//     bits 44-59  program           (shader permutation key)
+//     bit  43     blend             (0: off, 1: on)
+//     bit  42     polygon mode      (0: GL_FILL, 1: GL_LINE)
+//     bits  0-31  depth             (front to back; back to front if blended)
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Angel-yjc.h"
+
+struct DrawCommand {
+    uint64_t  key;          // see MakeSortKey()
+    int       object;       // material/permutation object id
+    GLuint    buffer;       // vertex buffer object to draw
+    int       numVertices;
+    bool      usesTexture;  // the buffer holds texture coordinates
+    mat4      mv;           // model-view matrix
+    GLuint    instanceBuffer;  // numInstances > 0: per-instance model matrices
+    int       numInstances;    //   drawn in one instanced draw; 0: a plain draw
+    GLint     stencilRef;   // stencil passes: the value marked, or tested
+};
+
+//  Build the sort key of a draw. "depth" is the eye-space distance to the
+//    object (>= 0); blended draws sort back to front, the others front to back.
+uint64_t MakeSortKey( unsigned pass, unsigned program, bool blend,
+		      GLenum polygonMode, GLfloat depth );
+
+//  Fields of a sort key
+inline unsigned SortKeyPass( uint64_t key )        { return (unsigned) (key >> 60); }
+inline bool     SortKeyBlend( uint64_t key )       { return (key >> 43) & 1; }
+inline GLenum   SortKeyPolygonMode( uint64_t key ) { return ((key >> 42) & 1) ? GL_LINE : GL_FILL; }
+
+class RenderQueue {
+    std::vector<DrawCommand>  _commands;
+
+   public:
+    void clear() { _commands.clear(); }
+    void push( const DrawCommand& command ) { _commands.push_back( command ); }
+
+    //  Replace the pass field of every key with slots[pass]; draws whose
+    //    slot is negative are removed
+    void remapPasses( const std::vector<int>& slots );
+
+    //  Sort by key; draws with equal keys keep their submission order
+    void sort();
+
+    int size() const { return (int) _commands.size(); }
+    const DrawCommand& operator [] ( int i ) const { return _commands[i]; }
+};
+
+#endif // __RENDERQUEUE_H__
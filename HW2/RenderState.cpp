@@ -0,0 +1,181 @@
+#include "RenderState.h"
+
+int renderStateIssued = 0;
+int renderStateSkipped = 0;
+
+// Number of uniform buffer binding points tracked (indices 0 .. 7)
+#define MAX_UNIFORM_BINDINGS 8
+
+// Last state set through the cache; only meaningful when "valid" is set
+static struct {
+    bool      valid;
+    GLenum    polygonMode;
+    int       depthTest;    // -1 when unknown
+    GLboolean depthMask;
+    GLboolean colorMask;
+    int       blend;        // -1 when unknown
+    GLenum    blendSrc, blendDst;
+    int       stencil;      // -1 when unknown
+    GLenum    stencilFunc, stencilZpass;
+    GLint     stencilRef;
+    GLuint    program;
+    GLuint    arrayBuffer;
+    GLuint    uniformBuffer;
+    GLuint    uniformBase[MAX_UNIFORM_BINDINGS];
+} cache;
+
+// Count the change and tell whether it must be issued
+static bool
+changed(bool differs)
+{
+    if ( cache.valid && !differs ) {
+	renderStateSkipped++;
+	return false;
+    }
+    renderStateIssued++;
+    return true;
+}
+
+void
+ResetRenderStateCounters()
+{
+    renderStateIssued = 0;
+    renderStateSkipped = 0;
+}
+
+void
+InvalidateRenderState()
+{
+    cache.valid = false;
+}
+
+// Called after issuing a change; the first change after an invalidation
+// marks everything else unknown by making it differ from any real value
+static void
+validate()
+{
+    if ( cache.valid ) { return; }
+
+    cache.valid = true;
+    cache.polygonMode = GL_NONE;
+    cache.depthTest = -1;
+    cache.depthMask = 2;
+    cache.colorMask = 2;
+    cache.blend = -1;
+    cache.blendSrc = cache.blendDst = GL_NONE;
+    cache.stencil = -1;
+    cache.stencilFunc = cache.stencilZpass = GL_NONE;
+    cache.stencilRef = -1;
+    cache.program = ~0u;
+    cache.arrayBuffer = ~0u;
+    cache.uniformBuffer = ~0u;
+    for ( int i = 0; i < MAX_UNIFORM_BINDINGS; i++ )
+	cache.uniformBase[i] = ~0u;
+}
+
+void
+SetPolygonMode(GLenum mode)
+{
+    if ( !changed( cache.polygonMode != mode ) ) { return; }
+    glPolygonMode( GL_FRONT_AND_BACK, mode );
+    validate();
+    cache.polygonMode = mode;
+}
+
+void
+SetDepthTest(bool enable)
+{
+    if ( !changed( cache.depthTest != (int) enable ) ) { return; }
+    if ( enable ) glEnable( GL_DEPTH_TEST );
+    else          glDisable( GL_DEPTH_TEST );
+    validate();
+    cache.depthTest = enable;
+}
+
+void
+SetDepthMask(GLboolean flag)
+{
+    if ( !changed( cache.depthMask != flag ) ) { return; }
+    glDepthMask( flag );
+    validate();
+    cache.depthMask = flag;
+}
+
+void
+SetColorMask(GLboolean flag)
+{
+    if ( !changed( cache.colorMask != flag ) ) { return; }
+    glColorMask( flag, flag, flag, flag );
+    validate();
+    cache.colorMask = flag;
+}
+
+void
+SetBlend(bool enable, GLenum sfactor, GLenum dfactor)
+{
+    // the blend function only matters while blending is enabled
+    bool wasValid = cache.valid;
+    if ( changed( cache.blend != (int) enable ) ) {
+	if ( enable ) glEnable( GL_BLEND );
+	else          glDisable( GL_BLEND );
+	validate();
+	cache.blend = enable;
+       }
+    if ( enable && changed( !wasValid || cache.blendSrc != sfactor
+			    || cache.blendDst != dfactor ) ) {
+	glBlendFunc( sfactor, dfactor );
+	cache.blendSrc = sfactor;
+	cache.blendDst = dfactor;
+       }
+}
+
+void
+SetStencil(bool enable, GLenum func, GLint ref, GLenum zpass)
+{
+    // the function and operation only matter while the test is enabled
+    bool wasValid = cache.valid;
+    if ( changed( cache.stencil != (int) enable ) ) {
+	if ( enable ) glEnable( GL_STENCIL_TEST );
+	else          glDisable( GL_STENCIL_TEST );
+	validate();
+	cache.stencil = enable;
+       }
+    if ( enable && changed( !wasValid || cache.stencilFunc != func
+			    || cache.stencilRef != ref || cache.stencilZpass != zpass ) ) {
+	glStencilFunc( func, ref, 0xFF );
+	glStencilOp( GL_KEEP, GL_KEEP, zpass );
+	cache.stencilFunc = func;
+	cache.stencilRef = ref;
+	cache.stencilZpass = zpass;
+       }
+}
+
+void
+UseProgram(GLuint program)
+{
+    if ( !changed( cache.program != program ) ) { return; }
+    glUseProgram( program );
+    validate();
+    cache.program = program;
+}
+
+void
+BindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint& current = (target == GL_UNIFORM_BUFFER) ? cache.uniformBuffer
+						     : cache.arrayBuffer;
+    if ( !changed( current != buffer ) ) { return; }
+    glBindBuffer( target, buffer );
+    validate();
+    current = buffer;
+}
+
+void
+BindUniformBufferBase(GLuint index, GLuint buffer)
+{
+    if ( !changed( cache.uniformBase[index] != buffer ) ) { return; }
+    glBindBufferBase( GL_UNIFORM_BUFFER, index, buffer );
+    validate();
+    cache.uniformBase[index] = buffer;
+    cache.uniformBuffer = buffer;  // also binds the generic binding point
+}
@@ -0,0 +1,40 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RenderState.h ---
+//
+//   A thin cache of the GL state changed while drawing. Each function only
+//   calls GL when the requested state differs from the one last set through
+//   the cache, and counts issued and skipped changes for the frame
+//   statistics. Code that changes the same state behind the cache's back
+//   must call InvalidateRenderState() afterwards.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RENDERSTATE_H__
+#define __RENDERSTATE_H__
+
+#include "Angel-yjc.h"
+
+//  State changes issued to GL / skipped as redundant since the last reset
+extern int renderStateIssued;
+extern int renderStateSkipped;
+
+void ResetRenderStateCounters();
+
+//  Forget all cached state; the next call of each function reaches GL
+void InvalidateRenderState();
+
+void SetPolygonMode( GLenum mode );       // for GL_FRONT_AND_BACK
+void SetDepthTest( bool enable );
+void SetDepthMask( GLboolean flag );
+void SetColorMask( GLboolean flag );      // same flag for R, G, B and A
+void SetBlend( bool enable, GLenum sfactor = GL_SRC_ALPHA,
+	       GLenum dfactor = GL_ONE_MINUS_SRC_ALPHA );
+//  Stencil test; on depth pass the stencil value becomes "zpass"'s result
+void SetStencil( bool enable, GLenum func = GL_ALWAYS, GLint ref = 0,
+		 GLenum zpass = GL_KEEP );
+void UseProgram( GLuint program );
+void BindBuffer( GLenum target, GLuint buffer );  // GL_ARRAY_BUFFER or GL_UNIFORM_BUFFER
+void BindUniformBufferBase( GLuint index, GLuint buffer );
+
+#endif // __RENDERSTATE_H__
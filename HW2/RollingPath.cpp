@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "RollingPath.h"
+
+bool
+RollingPath::set(int type, const std::vector<vec4>& points)
+{
+    int minimum = (type == BEZIER) ? 3 : 2;
+    if ( (int) points.size() < minimum || (type == BEZIER && points.size() % 3 != 0) )
+	return false;
+
+    _type = type;
+    _points = points;
+    _segments = (type == BEZIER) ? (int) points.size() / 3 : (int) points.size();
+    buildTable();
+    return true;
+}
+
+bool
+RollingPath::load(const char* filename)
+{
+    std::ifstream file( filename );
+    if ( !file ) {
+	printf( "Unable to open path file %s\n", filename );
+	return false;
+    }
+
+    // Strip comments, then read the type, the count and the points
+    std::stringstream text;
+    std::string line;
+    while ( std::getline( file, line ) )
+	text << line.substr( 0, line.find( '#' ) ) << "\n";
+
+    std::string name;
+    int count = 0;
+    text >> name >> count;
+
+    int type;
+    if      ( name == "polyline" )    { type = POLYLINE; }
+    else if ( name == "catmull-rom" ) { type = CATMULL_ROM; }
+    else if ( name == "bezier" )      { type = BEZIER; }
+    else {
+	printf( "%s: unknown path type \"%s\"\n", filename, name.c_str() );
+	return false;
+    }
+
+    std::vector<vec4> points;
+    for ( int i = 0; i < count; i++ ) {
+	GLfloat x, y, z;
+	if ( !(text >> x >> y >> z) ) { break; }
+	points.push_back( vec4( x, y, z, 1.0 ) );
+    }
+    if ( (int) points.size() != count || !set( type, points ) ) {
+	printf( "%s: wrong number of points for a %s path\n", filename, name.c_str() );
+	return false;
+    }
+    return true;
+}
+
+// Position and derivative of a segment at parameter t in [0, 1]
+void
+RollingPath::curve(int segment, GLfloat t, vec4& position, vec4& derivative) const
+{
+    if ( _type == POLYLINE ) {
+	vec4 p0 = point( segment ), p1 = point( segment + 1 );
+	position = p0 + t * (p1 - p0);
+	derivative = p1 - p0;
+	return;
+    }
+
+    // Both curves as cubic Bezier segments b0 .. b3
+    vec4 b0, b1, b2, b3;
+    if ( _type == CATMULL_ROM ) {
+	int n = (int) _points.size();
+	vec4 p0 = point( segment + n - 1 ), p1 = point( segment ),
+	     p2 = point( segment + 1 ), p3 = point( segment + 2 );
+	b0 = p1;
+	b1 = p1 + (p2 - p0) / 6.0;
+	b2 = p2 - (p3 - p1) / 6.0;
+	b3 = p2;
+    }
+    else {
+	b0 = point( 3 * segment );
+	b1 = point( 3 * segment + 1 );
+	b2 = point( 3 * segment + 2 );
+	b3 = point( 3 * segment + 3 );
+    }
+
+    GLfloat s = 1.0 - t;
+    position = s*s*s * b0 + 3.0*s*s*t * b1 + 3.0*s*t*t * b2 + t*t*t * b3;
+    derivative = 3.0*s*s * (b1 - b0) + 6.0*s*t * (b2 - b1) + 3.0*t*t * (b3 - b2);
+    position.w = 1.0;
+    derivative.w = 0.0;
+}
+
+void
+RollingPath::buildTable()
+{
+    _distance.clear();
+    _segment.clear();
+    _param.clear();
+
+    int steps = (_type == POLYLINE) ? 1 : PATH_SAMPLES;
+    GLfloat distance = 0.0;
+    vec4 previous, derivative;
+    curve( 0, 0.0, previous, derivative );
+    _low = _high = previous;
+
+    for ( int segment = 0; segment < _segments; segment++ ) {
+	for ( int i = 0; i < steps; i++ ) {
+	    _distance.push_back( distance );
+	    _segment.push_back( segment );
+	    _param.push_back( (GLfloat) i / steps );
+
+	    vec4 next;
+	    curve( segment, (GLfloat) (i + 1) / steps, next, derivative );
+	    distance += ::length( next - previous );
+	    previous = next;
+
+	    for ( int k = 0; k < 3; k++ ) {
+		_low[k] = std::min( _low[k], next[k] );
+		_high[k] = std::max( _high[k], next[k] );
+	    }
+	}
+    }
+
+    // closing sample: the end of the last segment, back at the start
+    _distance.push_back( distance );
+    _segment.push_back( _segments - 1 );
+    _param.push_back( 1.0 );
+}
+
+int
+RollingPath::findSample(GLfloat s) const
+{
+    // first sample beyond s, minus one; kept within the table
+    int i = (int) (std::upper_bound( _distance.begin(), _distance.end(), s )
+		   - _distance.begin()) - 1;
+    return std::min( std::max( i, 0 ), (int) _distance.size() - 2 );
+}
+
+void
+RollingPath::evaluate(GLfloat s, vec4& position, vec4& tangent) const
+{
+    int i = findSample( s );
+
+    // the parameter varies linearly between samples
+    GLfloat span = _distance[i + 1] - _distance[i];
+    GLfloat f = (span > 0.0) ? (s - _distance[i]) / span : 0.0;
+    GLfloat endParam = (_segment[i + 1] == _segment[i]) ? _param[i + 1] : 1.0;
+    GLfloat t = _param[i] + f * (endParam - _param[i]);
+
+    vec4 derivative;
+    curve( _segment[i], t, position, derivative );
+    GLfloat speed = ::length( derivative );
+    tangent = (speed > 0.0) ? derivative / speed : vec4( 1.0, 0.0, 0.0, 0.0 );
+}
@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RollingPath.h ---
+//
+//   The closed path followed by the center of the rolling sphere: a
+//   polyline, a Catmull-Rom spline through the points, or a chain of cubic
+//   Bezier segments, loaded from a file or given as points.
+//
+//   The path is sampled once into an arc-length table (the vertices of a
+//   polyline, PATH_SAMPLES points per curve segment), so that a position
+//   and tangent at any distance along it take a binary search, O(log n),
+//   however many points define it.
+//
+//   Path file format ('#' starts a comment):
+//     polyline | catmull-rom | bezier
+//     <number of points>
+//     x y z                       (one line per point)
+//   A polyline and a Catmull-Rom spline close back to their first point; a
+//   Bezier path has 3n points P0 .. P3n-1, segment k being P3k, P3k+1,
+//   P3k+2 and P3k+3 (P0 for the last one).
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ROLLINGPATH_H__
+#define __ROLLINGPATH_H__
+
+#include <vector>
+
+#include "Angel-yjc.h"
+
+#define PATH_SAMPLES  32     // arc-length samples per curve segment
+
+class RollingPath {
+   public:
+    enum { POLYLINE, CATMULL_ROM, BEZIER };
+
+   private:
+    int                 _type;
+    std::vector<vec4>   _points;     // control points (w = 1)
+    int                 _segments;
+
+    // arc-length table: sample i is at distance _distance[i] along the path,
+    // at parameter _param[i] of segment _segment[i]
+    std::vector<GLfloat> _distance;
+    std::vector<int>     _segment;
+    std::vector<GLfloat> _param;
+    vec4                 _low, _high;    // bounding box of the samples
+
+    vec4 point( int i ) const { return _points[i % _points.size()]; }
+    void curve( int segment, GLfloat t, vec4& position, vec4& derivative ) const;
+    void buildTable();
+
+   public:
+    RollingPath() : _type(POLYLINE), _segments(0) {}
+
+    //  Use "points" as a path of the given type; false if too few points
+    bool set( int type, const std::vector<vec4>& points );
+
+    //  Read a path file (see above); false, with a message, on error
+    bool load( const char* filename );
+
+    GLfloat length() const { return _distance.empty() ? 0.0 : _distance.back(); }
+
+    //  Arc-length table: numSamples() samples, from distance 0 to length()
+    int numSamples() const { return (int) _distance.size(); }
+    GLfloat sampleDistance( int i ) const { return _distance[i]; }
+
+    //  The sample i with sampleDistance(i) <= s < sampleDistance(i + 1), for
+    //    0 <= s < length(), by binary search
+    int findSample( GLfloat s ) const;
+
+    //  Position and unit tangent at distance s (0 <= s <= length())
+    void evaluate( GLfloat s, vec4& position, vec4& tangent ) const;
+
+    //  Bounding box of the path (of its arc-length samples)
+    const vec4& low() const { return _low; }
+    const vec4& high() const { return _high; }
+};
+
+#endif // __ROLLINGPATH_H__
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ShaderBuilder.h"
+
+#ifdef HAVE_EGL
+#  include <EGL/egl.h>
+#  include <EGL/eglext.h>
+#endif
+#ifdef HAVE_GLX
+#  include <X11/Xlib.h>
+#  include <GL/glx.h>
+#endif
+
+enum { BUILD_BLOCKING, BUILD_PARALLEL, BUILD_THREAD };
+
+static int mode = BUILD_BLOCKING;
+static int nextBuild = 1;
+
+// BUILD_PARALLEL and BUILD_BLOCKING: the builds not yet reported, with
+// their programs once done (0 for a failed build)
+static std::map<int, ShaderBuild*> parallelBuilds;
+static std::map<int, GLuint> finishedBuilds;
+
+//----------------------------------------------------------------------------
+// BUILD_THREAD: the builder thread, and the queue of builds it works through
+
+struct ThreadJob {
+    int          build;
+    std::string  files[2];
+    std::string  preamble;
+};
+
+static std::mutex jobMutex;
+static std::condition_variable jobReady;
+static std::deque<ThreadJob> jobs;
+static std::map<int, GLuint> threadResults;  // built by the thread, not yet reported
+static int cancelledBelow = 0;               // builds below this id were cancelled
+static bool stopping = false;                // the program is exiting
+static std::thread builder;
+
+// The context of the builder thread, sharing its objects with the GL
+// thread's, made current in the thread by makeThreadContextCurrent()
+#ifdef HAVE_EGL
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglThreadContext = EGL_NO_CONTEXT;
+#endif
+#ifdef HAVE_GLX
+static Display*   glxDisplay = NULL;
+static GLXContext glxThreadContext = NULL;
+static bool       xThreads = false;  // XInitThreads() was called
+#endif
+
+static bool
+createThreadContext()
+{
+#ifdef HAVE_EGL
+    if ( eglGetCurrentContext() != EGL_NO_CONTEXT ) {
+	EGLint attributes[] = {
+	    EGL_CONTEXT_MAJOR_VERSION, 3,
+	    EGL_CONTEXT_MINOR_VERSION, 2,
+	    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+	    EGL_NONE
+	};
+	eglDisplay = eglGetCurrentDisplay();
+	eglThreadContext = eglCreateContext( eglDisplay, EGL_NO_CONFIG_KHR,
+					     eglGetCurrentContext(), attributes );
+	return eglThreadContext != EGL_NO_CONTEXT;
+       }
+#endif
+#ifdef HAVE_GLX
+    GLXContext current = glXGetCurrentContext();
+    if ( current != NULL && xThreads ) {
+	typedef GLXContext (*CreateContextAttribs)( Display*, GLXFBConfig, GLXContext,
+						    Bool, const int* );
+	CreateContextAttribs createContextAttribs = (CreateContextAttribs)
+	    glXGetProcAddress( (const GLubyte*) "glXCreateContextAttribsARB" );
+	if ( createContextAttribs == NULL ) { return false; }
+
+	// Same config as the window's context, which sharing requires
+	glxDisplay = glXGetCurrentDisplay();
+	int id = 0, screen = 0, numConfigs = 0;
+	glXQueryContext( glxDisplay, current, GLX_FBCONFIG_ID, &id );
+	glXQueryContext( glxDisplay, current, GLX_SCREEN, &screen );
+	int configAttributes[] = { GLX_FBCONFIG_ID, id, None };
+	GLXFBConfig* configs = glXChooseFBConfig( glxDisplay, screen, configAttributes,
+						  &numConfigs );
+	if ( configs == NULL ) { return false; }
+
+	// A 3.x context may be made current without a drawable
+	int attributes[] = {
+	    GLX_CONTEXT_MAJOR_VERSION_ARB, 3,
+	    GLX_CONTEXT_MINOR_VERSION_ARB, 2,
+	    GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB,
+	    None
+	};
+	glxThreadContext = createContextAttribs( glxDisplay, configs[0], current, True,
+						 attributes );
+	XFree( configs );
+	return glxThreadContext != NULL;
+       }
+#endif
+    return false;
+}
+
+static bool
+makeThreadContextCurrent()
+{
+#ifdef HAVE_EGL
+    if ( eglThreadContext != EGL_NO_CONTEXT )
+	return eglMakeCurrent( eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			       eglThreadContext ) == EGL_TRUE;
+#endif
+#ifdef HAVE_GLX
+    if ( glxThreadContext != NULL )
+	return glXMakeContextCurrent( glxDisplay, None, None, glxThreadContext ) == True;
+#endif
+    return false;
+}
+
+static void
+releaseThreadContext()
+{
+#ifdef HAVE_EGL
+    if ( eglThreadContext != EGL_NO_CONTEXT )
+	eglMakeCurrent( eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+#endif
+#ifdef HAVE_GLX
+    if ( glxThreadContext != NULL )
+	glXMakeContextCurrent( glxDisplay, None, None, NULL );
+#endif
+}
+
+static void
+destroyThreadContext()
+{
+#ifdef HAVE_EGL
+    if ( eglThreadContext != EGL_NO_CONTEXT )
+	eglDestroyContext( eglDisplay, eglThreadContext );
+    eglThreadContext = EGL_NO_CONTEXT;
+#endif
+#ifdef HAVE_GLX
+    if ( glxThreadContext != NULL )
+	glXDestroyContext( glxDisplay, glxThreadContext );
+    glxThreadContext = NULL;
+#endif
+}
+
+// Build the queued programs one after another. A program is only handed
+// back once glFinish() has returned, so that it is complete when the GL
+// thread first uses it.
+static void
+builderThread(std::mutex* startMutex, std::condition_variable* started, int* startResult)
+{
+    bool current = makeThreadContextCurrent();
+    {
+	std::lock_guard<std::mutex> lock( *startMutex );
+	*startResult = current ? 1 : 0;
+    }
+    started->notify_one();
+    if ( !current ) { return; }
+
+    for (;;) {
+	ThreadJob job;
+	{
+	    std::unique_lock<std::mutex> lock( jobMutex );
+	    while ( jobs.empty() && !stopping ) { jobReady.wait( lock ); }
+	    if ( stopping ) { break; }
+	    job = jobs.front();
+	    jobs.pop_front();
+	}
+
+	GLuint program = TryInitShader( job.files[0].c_str(), job.files[1].c_str(),
+					job.preamble.c_str() );
+	glFinish();
+
+	std::lock_guard<std::mutex> lock( jobMutex );
+	if ( job.build < cancelledBelow ) {
+	    if ( program != 0 ) { glDeleteProgram( program ); }
+	   }
+	else
+	    threadResults[job.build] = program;
+    }
+    releaseThreadContext();
+}
+
+// At exit, stop the builder thread (after the build in progress, if any)
+// before the GL thread's context goes: the driver may not tear down a
+// context still current in another thread
+static void
+stopBuilderThread()
+{
+    {
+	std::lock_guard<std::mutex> lock( jobMutex );
+	stopping = true;
+    }
+    jobReady.notify_one();
+    builder.join();
+    destroyThreadContext();
+}
+
+//----------------------------------------------------------------------------
+
+void
+EnableShaderBuilderThread()
+{
+#ifdef HAVE_GLX
+    xThreads = XInitThreads() != 0;
+#endif
+}
+
+void
+InitShaderBuilder()
+{
+    // The driver chooses how many threads it compiles with, unless told
+    // otherwise (glMaxShaderCompilerThreadsKHR)
+    if ( ParallelShaderCompileSupported() )
+	mode = BUILD_PARALLEL;
+    else if ( createThreadContext() ) {
+	std::mutex startMutex;
+	std::condition_variable started;
+	int startResult = -1;
+	builder = std::thread( builderThread, &startMutex, &started, &startResult );
+
+	std::unique_lock<std::mutex> lock( startMutex );
+	while ( startResult < 0 ) { started.wait( lock ); }
+	if ( startResult == 1 ) {
+	    mode = BUILD_THREAD;
+	    atexit( stopBuilderThread );
+	   }
+	else {
+	    builder.join();
+	    destroyThreadContext();
+	   }
+       }
+    printf( "Shader builds: %s\n", ShaderBuilderMode() );
+}
+
+const char*
+ShaderBuilderMode()
+{
+    switch ( mode ) {
+    case BUILD_PARALLEL: return "parallel driver compile";
+    case BUILD_THREAD:   return "builder thread";
+    default:             return "blocking";
+    }
+}
+
+int
+StartShaderBuild(const char* vShaderFile, const char* fShaderFile,
+		 const std::string& preamble)
+{
+    int build = nextBuild++;
+
+    if ( mode == BUILD_PARALLEL ) {
+	ShaderBuild* b = BeginShaderBuild( vShaderFile, fShaderFile, preamble.c_str() );
+	if ( b == NULL )
+	    finishedBuilds[build] = 0;
+	else
+	    parallelBuilds[build] = b;
+       }
+    else if ( mode == BUILD_THREAD ) {
+	ThreadJob job;
+	job.build = build;
+	job.files[0] = vShaderFile;
+	job.files[1] = fShaderFile;
+	job.preamble = preamble;
+	{
+	    std::lock_guard<std::mutex> lock( jobMutex );
+	    jobs.push_back( job );
+	}
+	jobReady.notify_one();
+       }
+    else
+	finishedBuilds[build] = TryInitShader( vShaderFile, fShaderFile, preamble.c_str() );
+
+    return build;
+}
+
+int
+PollShaderBuild(int build, GLuint* program)
+{
+    std::map<int, ShaderBuild*>::iterator pending = parallelBuilds.find( build );
+    if ( pending != parallelBuilds.end() ) {
+	if ( !ShaderBuildReady( pending->second ) ) { return SHADER_BUILD_PENDING; }
+	finishedBuilds[build] = EndShaderBuild( pending->second );
+	parallelBuilds.erase( pending );
+       }
+
+    if ( mode == BUILD_THREAD ) {
+	std::lock_guard<std::mutex> lock( jobMutex );
+	std::map<int, GLuint>::iterator result = threadResults.find( build );
+	if ( result == threadResults.end() ) { return SHADER_BUILD_PENDING; }
+	finishedBuilds[build] = result->second;
+	threadResults.erase( result );
+       }
+
+    std::map<int, GLuint>::iterator finished = finishedBuilds.find( build );
+    if ( finished == finishedBuilds.end() ) { return SHADER_BUILD_FAILED; }  // unknown id
+    *program = finished->second;
+    finishedBuilds.erase( finished );
+    return (*program != 0) ? SHADER_BUILD_DONE : SHADER_BUILD_FAILED;
+}
+
+void
+CancelShaderBuilds()
+{
+    for ( std::map<int, ShaderBuild*>::iterator i = parallelBuilds.begin();
+	  i != parallelBuilds.end(); ++i )
+	DiscardShaderBuild( i->second );
+    parallelBuilds.clear();
+
+    if ( mode == BUILD_THREAD ) {
+	std::lock_guard<std::mutex> lock( jobMutex );
+	jobs.clear();
+	cancelledBelow = nextBuild;
+	for ( std::map<int, GLuint>::iterator i = threadResults.begin();
+	      i != threadResults.end(); ++i )
+	    if ( i->second != 0 ) { glDeleteProgram( i->second ); }
+	threadResults.clear();
+       }
+
+    for ( std::map<int, GLuint>::iterator i = finishedBuilds.begin();
+	  i != finishedBuilds.end(); ++i )
+	if ( i->second != 0 ) { glDeleteProgram( i->second ); }
+    finishedBuilds.clear();
+}
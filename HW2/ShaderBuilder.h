@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ShaderBuilder.h ---
+//
+//   Building of shader programs for hot reload without stalling the frames
+//   drawn meanwhile. A build is started, polled once per frame, and its
+//   program picked up when it is done, in one of three ways:
+//
+//   - with GL_KHR/ARB_parallel_shader_compile, the driver compiles and
+//     links in threads of its own: every build is issued at once on the GL
+//     thread and polled with GL_COMPLETION_STATUS_KHR;
+//   - otherwise, a thread of the builder's own builds the programs one
+//     after another in a GL context sharing its objects with the GL
+//     thread's (EGL, or GLX when built with HAVE_GLX), and hands back the
+//     linked program names;
+//   - failing both (e.g. on macOS), a build is done when started, as with
+//     TryInitShader().
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SHADERBUILDER_H__
+#define __SHADERBUILDER_H__
+
+#include <string>
+
+#include "Angel-yjc.h"
+
+enum { SHADER_BUILD_PENDING, SHADER_BUILD_DONE, SHADER_BUILD_FAILED };
+
+//  Call at the start of main(), before GLUT opens the display, so that the
+//    builder thread may share it (XInitThreads() with GLX; no-op otherwise)
+void EnableShaderBuilderThread();
+
+//  Choose how to build, from the GL context current on the calling (GL)
+//    thread; the builds are then started and polled on that thread
+void InitShaderBuilder();
+const char* ShaderBuilderMode();
+
+//  Start building TryInitShader( vShaderFile, fShaderFile, preamble );
+//    returns the id of the build
+int  StartShaderBuild( const char* vShaderFile, const char* fShaderFile,
+		       const std::string& preamble );
+
+//  SHADER_BUILD_PENDING, or once finished SHADER_BUILD_DONE with *program
+//    set, or SHADER_BUILD_FAILED (the errors printed). A finished build is
+//    forgotten once reported
+int  PollShaderBuild( int build, GLuint* program );
+
+//  Drop the builds not yet reported finished, deleting their programs
+void CancelShaderBuilds();
+
+#endif // __SHADERBUILDER_H__
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
+
+#include "ShaderWatcher.h"
+
+// Set by the watcher thread, cleared by ShaderFilesChanged()
+static std::atomic<bool> filesChanged(false);
+
+// Directory part of "path" ("." if none) and the file name part
+static std::string
+dirName(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? "." : path.substr(0, slash);
+}
+
+static std::string
+baseName(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+#ifdef __linux__
+
+// Watch the directories holding the files rather than the files themselves:
+// most editors save by writing a new file and renaming it over the old one,
+// which would silently end a watch on the old inode.
+static void
+watchThread(int fd, std::vector<std::string> names)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+	ssize_t len = read( fd, buf, sizeof(buf) );
+	if ( len <= 0 ) { break; }
+
+	for ( char* p = buf; p < buf + len; ) {
+	    const struct inotify_event* event = (const struct inotify_event*) p;
+	    if ( event->len > 0 ) {
+		for ( size_t i = 0; i < names.size(); i++ )
+		    if ( names[i] == event->name ) { filesChanged = true; }
+	       }
+	    p += sizeof(struct inotify_event) + event->len;
+	   }
+    }
+    close( fd );
+}
+
+bool
+StartShaderWatcher(const char* const files[], int count)
+{
+    int fd = inotify_init();
+    if ( fd < 0 ) {
+	perror( "inotify_init" );
+	return false;
+       }
+
+    std::vector<std::string> names;
+    for ( int i = 0; i < count; i++ ) {
+	names.push_back( baseName(files[i]) );
+	if ( inotify_add_watch( fd, dirName(files[i]).c_str(),
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE ) < 0 ) {
+	    perror( files[i] );
+	    close( fd );
+	    return false;
+	   }
+    }
+
+    std::thread( watchThread, fd, names ).detach();
+    return true;
+}
+
+#else // no inotify: poll the modification times
+
+static time_t
+modificationTime(const std::string& path)
+{
+    struct stat st;
+    return ( stat( path.c_str(), &st ) == 0 ) ? st.st_mtime : 0;
+}
+
+static void
+pollThread(std::vector<std::string> paths)
+{
+    std::vector<time_t> times;
+    for ( size_t i = 0; i < paths.size(); i++ )
+	times.push_back( modificationTime(paths[i]) );
+
+    for (;;) {
+	std::this_thread::sleep_for( std::chrono::milliseconds(250) );
+	for ( size_t i = 0; i < paths.size(); i++ ) {
+	    time_t t = modificationTime( paths[i] );
+	    if ( t != times[i] ) { times[i] = t;  filesChanged = true; }
+	   }
+    }
+}
+
+bool
+StartShaderWatcher(const char* const files[], int count)
+{
+    std::vector<std::string> paths( files, files + count );
+    std::thread( pollThread, paths ).detach();
+    return true;
+}
+
+#endif // __linux__
+
+bool
+ShaderFilesChanged()
+{
+    return filesChanged.exchange( false );
+}
@@ -0,0 +1,22 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ShaderWatcher.h ---
+//
+//   Background watching of shader files for hot reload. A thread waits for
+//   the files to be rewritten (inotify on Linux, polling of the modification
+//   time elsewhere); the GL thread polls ShaderFilesChanged() and rebuilds
+//   its programs itself, since GL calls must stay on that thread.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SHADERWATCHER_H__
+#define __SHADERWATCHER_H__
+
+//  Start watching the "count" files in "files" (paths relative to the
+//    current directory). Returns false if the watcher cannot be started.
+bool StartShaderWatcher( const char* const files[], int count );
+
+//  Return true once for every batch of changes since the previous call
+bool ShaderFilesChanged();
+
+#endif // __SHADERWATCHER_H__
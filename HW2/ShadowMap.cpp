@@ -0,0 +1,121 @@
+#include <stdio.h>
+
+#include "ShadowMap.h"
+
+bool
+ShadowMap::init(int resolution, GLenum unit)
+{
+    _unit = unit;
+    glGenTextures( 1, &_texture );
+    glGenFramebuffers( 1, &_framebuffer );
+    setResolution( resolution );
+
+    GLint previous;
+    glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &previous );
+    glBindFramebuffer( GL_FRAMEBUFFER, _framebuffer );
+    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _texture, 0 );
+    glDrawBuffer( GL_NONE );      // depth only
+    glReadBuffer( GL_NONE );
+    GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+    glBindFramebuffer( GL_FRAMEBUFFER, previous );
+
+    if ( status != GL_FRAMEBUFFER_COMPLETE ) {
+	printf( "Shadow map framebuffer incomplete (0x%x)\n", status );
+	return false;
+    }
+    return true;
+}
+
+void
+ShadowMap::setResolution(int resolution)
+{
+    _resolution = resolution;
+    _valid = false;
+
+    // Linear filtering of a depth comparison texture blends the results of
+    // the 2x2 nearest comparisons, on top of the PCF taps of the shader
+    glActiveTexture( _unit );
+    glBindTexture( GL_TEXTURE_2D, _texture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0,
+		  GL_DEPTH_COMPONENT, GL_FLOAT, NULL );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
+}
+
+bool
+ShadowMap::setLight(const vec4& position, const vec4& direction,
+		    GLfloat fovy, GLfloat zNear, GLfloat zFar)
+{
+    if ( position.x == _position.x && position.y == _position.y &&
+	 position.z == _position.z && direction.x == _direction.x &&
+	 direction.y == _direction.y && direction.z == _direction.z &&
+	 fovy == _fovy && zNear == _near && zFar == _far )
+	return false;
+
+    _position = position;
+    _direction = direction;
+    _fovy = fovy;
+    _near = zNear;
+    _far = zFar;
+
+    // up is any direction not along the light's
+    vec4 up( 0.0, 1.0, 0.0, 0.0 );
+    vec3 axis = normalize( vec3( direction.x, direction.y, direction.z ) );
+    if ( fabs( axis.y ) > 0.99 )
+	up = vec4( 0.0, 0.0, 1.0, 0.0 );
+    vec4 at = position + vec4( direction.x, direction.y, direction.z, 0.0 );
+
+    _view = LookAt( position, at, up );
+    _projection = Perspective( fovy, 1.0, zNear, zFar );
+    _valid = false;
+    return true;
+}
+
+void
+ShadowMap::begin()
+{
+    glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &_previousFramebuffer );
+    glGetIntegerv( GL_VIEWPORT, _previousViewport );
+
+    glBindFramebuffer( GL_FRAMEBUFFER, _framebuffer );
+    glViewport( 0, 0, _resolution, _resolution );
+    glClear( GL_DEPTH_BUFFER_BIT );
+
+    // Push the casters' depths back, more so on slopes, so that a lit
+    // surface does not shadow itself where it is sampled (shadow acne)
+    glEnable( GL_POLYGON_OFFSET_FILL );
+    glPolygonOffset( 2.0, 4.0 );
+}
+
+void
+ShadowMap::end()
+{
+    glDisable( GL_POLYGON_OFFSET_FILL );
+    glBindFramebuffer( GL_FRAMEBUFFER, _previousFramebuffer );
+    glViewport( _previousViewport[0], _previousViewport[1],
+		_previousViewport[2], _previousViewport[3] );
+    _valid = true;
+    _renders++;
+}
+
+mat4
+ShadowMap::eyeToMap(const mat4& eyeView) const
+{
+    // The inverse of a rotation R and translation t: R^T and -R^T t
+    mat4 eyeToWorld;
+    for ( int i = 0; i < 3; i++ ) {
+	for ( int j = 0; j < 3; j++ )
+	    eyeToWorld[i][j] = eyeView[j][i];
+	eyeToWorld[i][3] = -( eyeView[0][i] * eyeView[0][3] +
+			      eyeView[1][i] * eyeView[1][3] +
+			      eyeView[2][i] * eyeView[2][3] );
+    }
+
+    // clip coordinates [-1, 1] to map coordinates [0, 1]
+    mat4 bias = Translate( 0.5, 0.5, 0.5 ) * Scale( 0.5, 0.5, 0.5 );
+    return bias * _projection * _view * eyeToWorld;
+}
@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ShadowMap.h ---
+//
+//   Depth map of the shadow casters seen from a light: a square depth
+//   texture of configurable resolution, rendered through its own
+//   framebuffer object and sampled with depth comparison (sampler2DShadow)
+//   by the receivers.
+//
+//   The map is cached: it stays valid until the light is moved with
+//   setLight() or the caller reports moved casters with invalidate(), and
+//   a valid map is simply reused by the next frames.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+
+#include "Angel-yjc.h"
+
+#define SHADOW_MAP_DEFAULT_SIZE  1024
+
+class ShadowMap {
+    GLuint      _texture;
+    GLenum      _unit;               // texture unit the map stays bound to
+    GLuint      _framebuffer;
+    int         _resolution;
+    bool        _valid;              // the map holds the current casters
+
+    vec4        _position, _direction;
+    GLfloat     _fovy, _near, _far;
+    mat4        _view, _projection;  // light frame and its perspective
+
+    GLint       _previousFramebuffer;
+    GLint       _previousViewport[4];
+    int         _renders;            // times the map has been rendered
+
+  public:
+    ShadowMap() : _texture(0), _unit(GL_TEXTURE0), _framebuffer(0),
+                  _resolution(SHADOW_MAP_DEFAULT_SIZE), _valid(false), _fovy(0.0), _near(0.0), _far(0.0),
+                  _previousFramebuffer(0), _renders(0) {}
+
+    //  Create the depth texture, bound to texture unit "unit" (GL_TEXTURE0
+    //    + n) for good, and its framebuffer; false, with a message, if the
+    //    framebuffer is not complete. Needs a current GL context
+    bool init( int resolution, GLenum unit );
+
+    //  Resize the map (resolution x resolution texels); it is re-rendered
+    void setResolution( int resolution );
+    int resolution() const { return _resolution; }
+
+    //  The light at "position" looking along "direction", with a field of
+    //    view of fovy degrees; a change invalidates the map and returns true
+    bool setLight( const vec4& position, const vec4& direction,
+		   GLfloat fovy, GLfloat zNear, GLfloat zFar );
+    const mat4& view() const { return _view; }
+    const mat4& projection() const { return _projection; }
+
+    //  A caster has moved: the map is re-rendered before its next use
+    void invalidate() { _valid = false; }
+    bool valid() const { return _valid; }
+
+    //  Draw the casters between begin() and end(), with view() and
+    //    projection(); the depth mask must be on. end() restores the
+    //    framebuffer and viewport in use before begin()
+    void begin();
+    void end();
+    int renders() const { return _renders; }
+
+    //  From the eye frame of the viewing matrix "eyeView" (a rotation and a
+    //    translation, as from LookAt()) to map coordinates: x, y and the
+    //    depth to compare, all in [0, 1] inside the light's frustum
+    mat4 eyeToMap( const mat4& eyeView ) const;
+};
+
+#endif // __SHADOWMAP_H__
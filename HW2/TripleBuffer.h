@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- TripleBuffer.h ---
+//
+//   Lock-free hand-over of values from one writer thread to one reader
+//   thread. The writer fills back() and publish()es it; the reader's read()
+//   returns the newest published value. Neither side ever waits: with three
+//   slots, the writer always has a slot the reader is not using, and the
+//   reader keeps its slot until a newer one has been published.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TRIPLEBUFFER_H__
+#define __TRIPLEBUFFER_H__
+
+#include <atomic>
+
+template <class T>
+class TripleBuffer {
+    enum { FRESH = 4 };              // set in _middle when it holds a new value
+
+    T                      _slots[3];
+    std::atomic<unsigned>  _middle;  // slot last published (| FRESH)
+    unsigned               _back;    // slot owned by the writer
+    unsigned               _front;   // slot owned by the reader
+
+   public:
+    TripleBuffer() : _middle(1), _back(0), _front(2) {}
+
+    //  Writer: the slot to fill, then publish it
+    T& back() { return _slots[_back]; }
+    void publish() {
+	unsigned old = _middle.exchange( _back | FRESH, std::memory_order_acq_rel );
+	_back = old & ~FRESH;
+    }
+
+    //  Reader: the newest published value; it stays valid until the next read()
+    const T& read() {
+	if ( _middle.load( std::memory_order_acquire ) & FRESH ) {
+	    unsigned old = _middle.exchange( _front, std::memory_order_acq_rel );
+	    _front = old & ~FRESH;
+	   }
+	return _slots[_front];
+    }
+};
+
+#endif // __TRIPLEBUFFER_H__
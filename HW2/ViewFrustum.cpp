@@ -0,0 +1,69 @@
+#include <algorithm>
+
+#include "ViewFrustum.h"
+
+BoundingSphere
+ComputeBoundingSphere(const vec3* points, int n)
+{
+    if ( n == 0 )
+	return BoundingSphere();
+
+    vec3 low = points[0], high = points[0];
+    for ( int i = 1; i < n; i++ ) {
+	low.x = std::min( low.x, points[i].x );    high.x = std::max( high.x, points[i].x );
+	low.y = std::min( low.y, points[i].y );    high.y = std::max( high.y, points[i].y );
+	low.z = std::min( low.z, points[i].z );    high.z = std::max( high.z, points[i].z );
+    }
+
+    vec3 center = 0.5 * (low + high);
+    GLfloat radius2 = 0.0;
+    for ( int i = 0; i < n; i++ )
+	radius2 = std::max( radius2, dot( points[i] - center, points[i] - center ) );
+
+    return BoundingSphere( center, sqrt( radius2 ) );
+}
+
+BoundingSphere
+TransformBoundingSphere(const mat4& model, const BoundingSphere& sphere)
+{
+    vec4 center = model * vec4( sphere.center, 1.0 );
+
+    // largest scale factor: the longest column of the upper 3x3
+    GLfloat scale2 = 0.0;
+    for ( int j = 0; j < 3; j++ )
+	scale2 = std::max( scale2, model[0][j] * model[0][j] + model[1][j] * model[1][j] +
+				   model[2][j] * model[2][j] );
+
+    return BoundingSphere( vec3( center.x, center.y, center.z ), sphere.radius * sqrt( scale2 ) );
+}
+
+void
+ViewFrustum::set(const mat4& projectionView)
+{
+    const mat4& m = projectionView;
+
+    _planes[0] = m[3] + m[0];    // left
+    _planes[1] = m[3] - m[0];    // right
+    _planes[2] = m[3] + m[1];    // bottom
+    _planes[3] = m[3] - m[1];    // top
+    _planes[4] = m[3] + m[2];    // near
+    _planes[5] = m[3] - m[2];    // far
+
+    for ( int i = 0; i < 6; i++ ) {
+	vec4& plane = _planes[i];
+	plane /= sqrt( plane.x * plane.x + plane.y * plane.y + plane.z * plane.z );
+    }
+}
+
+bool
+ViewFrustum::intersects(const BoundingSphere& sphere) const
+{
+    for ( int i = 0; i < 6; i++ ) {
+	const vec4& plane = _planes[i];
+	GLfloat distance = plane.x * sphere.center.x + plane.y * sphere.center.y +
+			   plane.z * sphere.center.z + plane.w;
+	if ( distance < -sphere.radius )
+	    return false;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ViewFrustum.h ---
+//
+//   View frustum culling with bounding spheres. Each mesh gets a bounding
+//   sphere in its object frame when it is loaded or generated; an object is
+//   drawn only if that sphere, moved by its model matrix, is not entirely
+//   outside one of the six planes of the frustum.
+//
+//   The planes are taken from the rows of the projection * viewing matrix
+//   (Gribb & Hartmann), so they are in the world frame.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __VIEWFRUSTUM_H__
+#define __VIEWFRUSTUM_H__
+
+#include "Angel-yjc.h"
+
+struct BoundingSphere {
+    vec3     center;
+    GLfloat  radius;
+
+    BoundingSphere() : radius(0.0) {}
+    BoundingSphere( const vec3& c, GLfloat r ) : center(c), radius(r) {}
+};
+
+//  Bounding sphere of n points: centered on their bounding box, with the
+//    radius of the farthest point
+BoundingSphere ComputeBoundingSphere( const vec3* points, int n );
+
+//  The sphere moved by the model matrix "model" (rotation, translation and
+//    scaling; the radius grows with the largest scale factor)
+BoundingSphere TransformBoundingSphere( const mat4& model, const BoundingSphere& sphere );
+
+class ViewFrustum {
+    vec4  _planes[6];   // a x + b y + c z + d >= 0 inside, (a, b, c) unit
+
+  public:
+    //  The frustum of the projection * viewing matrix "projectionView"
+    void set( const mat4& projectionView );
+
+    //  false if the sphere is entirely outside the frustum
+    bool intersects( const BoundingSphere& sphere ) const;
+
+    //  Plane i: left, right, bottom, top, near, far
+    const vec4& plane( int i ) const { return _planes[i]; }
+};
+
+#endif // __VIEWFRUSTUM_H__
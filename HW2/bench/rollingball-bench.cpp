@@ -0,0 +1,327 @@
+/************************************************************
+ * rollingball-bench: deterministic headless benchmark of the rolling
+   sphere (rotate-cube-new.cpp, built with ROLLINGBALL_BENCH so that its
+   main() is left out).
+
+   The "balls-N" scenarios sweep the number of balls (--balls N), all drawn
+   in one instanced draw, to show how the cost scales with the ball count.
+   Each scenario also reports the mean CPU times of the view frustum culling
+   of the balls and of their planar shadows (0 with one ball): the refit of
+   their trees to the moved balls, and the cull itself, with the number of
+   tree rebuilds over the measured frames.
+
+   Every scenario runs in its own child process, so that it starts from the
+   program's initial state with a fresh offscreen context: the sphere file is
+   loaded, the scenario's menu options are applied, then the sphere rolls for
+   a fixed number of frames with the usual fixed animation step. The parent
+   reports the mean, p50, p95 and p99 frame times of each scenario and writes
+   them as JSON, so that runs can be diffed across commits.
+
+   Run from the directory holding the shaders and sphere files:
+     rollingball-bench [--frames N] [--warmup N] [--size WxH]
+                       [--output results.json] [--filter text] [--verbose]
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// from rotate-cube-new.cpp
+extern int headlessFrames, headlessWidth, headlessHeight;
+extern int ballCount;
+extern double ballRefitMs, ballCullMs;
+extern double ballShadowRefitMs, ballShadowCullMs;
+int ball_tree_rebuilds();
+bool load_sphere_file(const string& filename);
+bool init_headless();
+double headless_frame();
+void menu(int id);
+void shadow_menu(int id);
+void lighting_menu(int id);
+void shading_menu(int id);
+void lightsource_menu(int id);
+void fog_menu(int id);
+void shadowblend_menu(int id);
+void shadowmethod_menu(int id);
+void floortexture_menu(int id);
+void spheretexture_menu(int id);
+
+// A scenario is the sphere file and the menu entries chosen for each menu;
+// 0 keeps the program's initial setting. "balls" 0 is one ball.
+struct Scenario {
+    const char* name;
+    const char* sphere;
+    int shading;        // 1: flat, 2: smooth
+    int lighting;       // 1: on, 2: off
+    int lightsource;    // 1: spot light, 2: point source
+    int fog;            // 1: none, 2: linear, 3: exponential, 4: exponential square
+    int shadow;         // 1: on, 2: off
+    int blend;          // 1: blended shadow, 2: opaque shadow
+    int shadowmethod;   // 1: stencil, 2: two floor passes
+    int floortexture;   // 1: on, 2: off
+    int spheretexture;  // 1: checkerboard, 2: contour lines, 3: none
+    bool wireframe;
+    int balls;          // number of balls, as with --balls
+};
+
+Scenario scenarios[] = {
+    // name                  sphere           shad lit  src  fog  shdw blnd mthd flr  sph  wire   balls
+    { "sphere8",             "sphere8.txt",    0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "sphere128",           "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "sphere256",           "sphere256.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "sphere1024",          "sphere1024.txt", 0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "flat-shading",        "sphere1024.txt", 1,   0,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "smooth-shading",      "sphere1024.txt", 2,   0,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "no-lighting",         "sphere1024.txt", 0,   2,   0,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "spot-light",          "sphere1024.txt", 0,   0,   1,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "point-light",         "sphere1024.txt", 0,   0,   2,   0,   0,   0,   0,   0,   0,   false, 0     },
+    { "fog-none",            "sphere1024.txt", 0,   0,   0,   1,   0,   0,   0,   0,   0,   false, 0     },
+    { "fog-linear",          "sphere1024.txt", 0,   0,   0,   2,   0,   0,   0,   0,   0,   false, 0     },
+    { "fog-exp",             "sphere1024.txt", 0,   0,   0,   3,   0,   0,   0,   0,   0,   false, 0     },
+    { "fog-exp2",            "sphere1024.txt", 0,   0,   0,   4,   0,   0,   0,   0,   0,   false, 0     },
+    { "shadow-off",          "sphere1024.txt", 0,   0,   0,   0,   2,   0,   0,   0,   0,   false, 0     },
+    { "shadow-blend",        "sphere1024.txt", 0,   0,   0,   0,   1,   1,   0,   0,   0,   false, 0     },
+    { "shadow-opaque",       "sphere1024.txt", 0,   0,   0,   0,   1,   2,   0,   0,   0,   false, 0     },
+    { "shadow-two-pass",     "sphere1024.txt", 0,   0,   0,   0,   1,   0,   2,   0,   0,   false, 0     },
+    { "floor-texture-off",   "sphere1024.txt", 0,   0,   0,   0,   0,   0,   0,   2,   0,   false, 0     },
+    { "sphere-checker",      "sphere1024.txt", 0,   0,   0,   0,   0,   0,   0,   0,   1,   false, 0     },
+    { "sphere-contour",      "sphere1024.txt", 0,   0,   0,   0,   0,   0,   0,   0,   2,   false, 0     },
+    { "sphere-texture-off",  "sphere1024.txt", 0,   0,   0,   0,   0,   0,   0,   0,   3,   false, 0     },
+    { "wireframe",           "sphere1024.txt", 0,   0,   0,   0,   0,   0,   0,   0,   0,   true,  0     },
+    { "balls-1",             "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 1     },
+    { "balls-10",            "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 10    },
+    { "balls-100",           "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 100   },
+    { "balls-1000",          "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 1000  },
+    { "balls-10000",         "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 10000 },
+    { "balls-50000",         "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 50000 },
+    { "balls-100000",        "sphere128.txt",  0,   0,   0,   0,   0,   0,   0,   0,   0,   false, 100000 },
+};
+const int NumScenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+
+struct Result {
+    const Scenario* scenario;
+    double mean, p50, p95, p99, min, max;
+    double refitMean;   // ball culling: tree refits
+    double cullMean;    //   and culls
+    int rebuilds;       //   and tree rebuilds
+};
+
+//----------------------------------------------------------------------------
+// run_scenario(scenario, frames, out):
+//   in the child process: set up "scenario" and write the time of each of
+//   "frames" frames, then those of its ball culling (refit and cull) and the
+//   tree rebuilds so far, to the file descriptor "out".
+//
+int run_scenario(const Scenario& scenario, int frames, int out)
+{
+    if (!load_sphere_file(scenario.sphere)) {
+        fprintf(stderr, "%s: cannot open %s\n", scenario.name, scenario.sphere);
+        return 1;
+    }
+    headlessFrames = frames;
+    ballCount = max(1, scenario.balls);
+    if (!init_headless())
+        return 1;
+
+    // the menus change GL buffers, so they come after init
+    if (scenario.shading)       shading_menu(scenario.shading);
+    if (scenario.lighting)      lighting_menu(scenario.lighting);
+    if (scenario.lightsource)   lightsource_menu(scenario.lightsource);
+    if (scenario.fog)           fog_menu(scenario.fog);
+    if (scenario.shadow)        shadow_menu(scenario.shadow);
+    if (scenario.blend)         shadowblend_menu(scenario.blend);
+    if (scenario.shadowmethod)  shadowmethod_menu(scenario.shadowmethod);
+    if (scenario.floortexture)  floortexture_menu(scenario.floortexture);
+    if (scenario.spheretexture) spheretexture_menu(scenario.spheretexture);
+    if (scenario.wireframe)     menu(3);
+
+    for (int frame = 0; frame < frames; frame++) {
+        double sample[4];
+        sample[0] = headless_frame();
+        sample[1] = ballRefitMs + ballShadowRefitMs;
+        sample[2] = ballCullMs + ballShadowCullMs;
+        sample[3] = ball_tree_rebuilds();
+        if (write(out, sample, sizeof(sample)) != sizeof(sample))
+            return 1;
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// percentile(sorted, p): nearest-rank percentile of sorted frame times
+//
+double percentile(const vector<double>& sorted, double p)
+{
+    size_t rank = (size_t) (p / 100.0 * sorted.size() + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > sorted.size()) rank = sorted.size();
+    return sorted[rank - 1];
+}
+
+//----------------------------------------------------------------------------
+// measure(scenario, frames, warmup, verbose, result):
+//   run "scenario" in a child process and summarize its frame times, leaving
+//   out the first "warmup" frames (shader compilation, first uploads).
+//
+bool measure(const Scenario& scenario, int frames, int warmup, bool verbose, Result& result)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        close(fds[0]);
+        if (!verbose) {  // keep the shader and renderer messages out of the report
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+        }
+        _exit(run_scenario(scenario, warmup + frames, fds[1]));
+    }
+
+    close(fds[1]);
+    vector<double> frameMs, refitMs, cullMs, rebuilds;
+    double sample[4];
+    while (read(fds[0], sample, sizeof(sample)) == sizeof(sample)) {
+        frameMs.push_back(sample[0]);
+        refitMs.push_back(sample[1]);
+        cullMs.push_back(sample[2]);
+        rebuilds.push_back(sample[3]);
+    }
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0
+        || (int) frameMs.size() != warmup + frames)
+        return false;
+
+    // rebuilds during the measured frames
+    result.rebuilds = (int) (rebuilds.back() - (warmup > 0 ? rebuilds[warmup - 1] : 0.0));
+
+    frameMs.erase(frameMs.begin(), frameMs.begin() + warmup);
+    refitMs.erase(refitMs.begin(), refitMs.begin() + warmup);
+    cullMs.erase(cullMs.begin(), cullMs.begin() + warmup);
+    vector<double> sorted = frameMs;
+    sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0, refitSum = 0.0, cullSum = 0.0;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        sum += sorted[i];
+        refitSum += refitMs[i];
+        cullSum += cullMs[i];
+    }
+
+    result.scenario = &scenario;
+    result.mean = sum / sorted.size();
+    result.p50 = percentile(sorted, 50.0);
+    result.p95 = percentile(sorted, 95.0);
+    result.p99 = percentile(sorted, 99.0);
+    result.min = sorted.front();
+    result.max = sorted.back();
+    result.refitMean = refitSum / refitMs.size();
+    result.cullMean = cullSum / cullMs.size();
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// write_json(path, results, frames, warmup)
+//
+bool write_json(const char* path, const vector<Result>& results, int frames, int warmup)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Unable to write %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"frames\": %d,\n  \"warmup\": %d,\n", frames, warmup);
+    fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n", headlessWidth, headlessHeight);
+    fprintf(file, "  \"scenarios\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"sphere\": \"%s\", \"balls\": %d, "
+                "\"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, "
+                "\"min_ms\": %.4f, \"max_ms\": %.4f, \"refit_ms\": %.4f, \"cull_ms\": %.4f, "
+                "\"rebuilds\": %d }%s\n",
+                r.scenario->name, r.scenario->sphere, max(1, r.scenario->balls),
+                r.mean, r.p50, r.p95, r.p99, r.min, r.max,
+                r.refitMean, r.cullMean, r.rebuilds, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    int frames = 300;
+    int warmup = 10;
+    const char* output = "rollingball-bench.json";
+    const char* filter = NULL;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &headlessWidth, &headlessHeight);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--verbose") == 0)
+            verbose = true;
+        else {
+            printf("usage: %s [--frames N] [--warmup N] [--size WxH] [--output results.json]"
+                   " [--filter text] [--verbose]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 1 || warmup < 0) {
+        printf("--frames must be at least 1 and --warmup at least 0\n");
+        return 1;
+    }
+
+    printf("%d frames (+%d warm-up) per scenario at %dx%d\n\n",
+           frames, warmup, headlessWidth, headlessHeight);
+    printf("%-20s %9s %9s %9s %9s %9s %9s %9s\n", "scenario", "mean ms", "p50 ms", "p95 ms",
+           "p99 ms", "refit ms", "cull ms", "rebuilds");
+
+    vector<Result> results;
+    int failures = 0;
+    for (int i = 0; i < NumScenarios; i++) {
+        if (filter != NULL && strstr(scenarios[i].name, filter) == NULL)
+            continue;
+
+        Result result;
+        if (!measure(scenarios[i], frames, warmup, verbose, result)) {
+            printf("%-20s failed\n", scenarios[i].name);
+            failures++;
+            continue;
+        }
+        printf("%-20s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9d\n", scenarios[i].name,
+               result.mean, result.p50, result.p95, result.p99,
+               result.refitMean, result.cullMean, result.rebuilds);
+        results.push_back(result);
+    }
+
+    if (write_json(output, results, frames, warmup))
+        printf("\nResults written to %s\n", output);
+    return failures == 0 ? 0 : 1;
+}
@@ -1,6 +1,12 @@
 /*****************************
  * File: fshader42.glsl
  *       A simple fragment shader
+ *
+ * Specialized by the same #defines as vshader42.glsl (see there).
+ *
+ * IS_SHADOW_MAPPED: the positional light is computed here, per fragment,
+ * and its diffuse and specular terms are scaled by the fraction of the
+ * 3x3 shadow map samples around the fragment that see the light (PCF).
  *****************************/
 
 #version 150  // YJC: Comment/un-comment this line to resolve compilation errors
@@ -9,60 +15,137 @@
 in vec4 color;
 in float z;
 in vec2 texCoord;
-flat in int fogFlagOut;
-flat in int isFloorFragment;
-flat in int isSphereFragment;
 out vec4 fColor;
 
 uniform sampler2D texture_2D;
 uniform sampler1D texture_1D;
-uniform int floortextureFlag;
 
-flat in int sphereCheckerFlagFragment;
+#if defined(IS_SHADOW_MAPPED)
+in vec3 eyePosition;
+in vec3 eyeNormal;
+in vec4 shadowCoord;
 
-void main() 
+uniform sampler2DShadow shadow_map;
+
+// Same blocks as in vshader42.glsl
+layout(std140) uniform LightingBlock {
+    vec4 DirectionalLightDirection;
+    vec4 LightPosition;
+    vec4 SpotLightDirection;
+    float ConstAtt;
+    float LinearAtt;
+    float QuadAtt;
+    float ExpVal;
+    float CutoffAngle;
+    layout(row_major) mat4 ShadowMatrix;
+};
+
+layout(std140) uniform MaterialBlock {
+    vec4 GlobalAmbientProduct;
+    vec4 PositionalAmbientProduct, PositionalDiffuseProduct, PositionalSpecularProduct;
+    vec4 DirectionalAmbientProduct, DirectionalDiffuseProduct, DirectionalSpecularProduct;
+    float Shininess;
+};
+
+// Fraction of the light reaching the fragment: 3x3 depth comparisons
+// around it, each already blended over 2x2 texels by linear filtering.
+// Outside the shadow map nothing is known to block the light.
+float shadow_visibility()
 {
-    vec4 newColor = color;
-    if (isFloorFragment == 1 && floortextureFlag == 1) {
-        newColor = color * texture( texture_2D, texCoord );
-    }
-    
-    if (isSphereFragment == 1 && sphereCheckerFlagFragment == 0) {
-        newColor = color * texture( texture_1D, texCoord[0] );
-    }
-    
-    if (isSphereFragment == 1 && sphereCheckerFlagFragment == 1) {
-        vec4 texColor = texture( texture_2D, texCoord );
-        if (texColor.x < 0.5) {
-            texColor = vec4(0.9, 0.1, 0.1, 1.0);
-        }
-        newColor = color * texColor;
-    }
-    
-    if (fogFlagOut == 0) {
-        fColor = newColor;
+    if (shadowCoord.w <= 0.0)
+        return 1.0;
+    vec3 coord = shadowCoord.xyz / shadowCoord.w;
+    if (any(lessThan(coord, vec3(0.0))) || any(greaterThan(coord, vec3(1.0))))
+        return 1.0;
+
+    vec2 texel = 1.0 / vec2(textureSize(shadow_map, 0));
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(shadow_map, vec3(coord.xy + vec2(x, y) * texel, coord.z));
+    return lit / 9.0;
+}
+
+// The positional light of vshader42.glsl, in the shadow of the casters
+vec4 positional_light()
+{
+    vec3 N = normalize(eyeNormal);
+    vec3 E = normalize(-eyePosition);
+    vec3 L = normalize(LightPosition.xyz - eyePosition);
+    vec3 H = normalize(L + E);
+
+    float dist = distance(LightPosition.xyz, eyePosition);
+    float attenuation = 1.0;
+#if defined(IS_POINT_SOURCE)
+    attenuation = 1.0 / (ConstAtt + (LinearAtt * dist) + (QuadAtt * (dist * dist)));
+#endif
+#if defined(IS_SPOTLIGHT)
+    if (dot(normalize(SpotLightDirection.xyz), -L) < cos(CutoffAngle)) {
+        attenuation = 0.0;
     }
-    
-    if (fogFlagOut == 1) {
-        vec4 fogColor = vec4(0.7, 0.7, 0.7, 0.5);
-        float start = 0.0;
-        float end = 18.0;
-        float fogEquation = (end - z) / (end - start);
-        fColor = mix(fogColor, newColor, clamp(fogEquation, 0.0, 1.0));
+    else {
+        attenuation = pow(dot(normalize(SpotLightDirection.xyz), -L), ExpVal) / (ConstAtt + (LinearAtt * dist) + (QuadAtt * (dist * dist)));
     }
-    
-    if (fogFlagOut == 2) {
-        float density = 0.09;
-        vec4 fogColor = vec4(0.7, 0.7, 0.7, 0.5);
-        float fogEquation = exp(-density * z);
-        fColor = mix(fogColor, newColor, clamp(fogEquation, 0.0, 1.0));
+#endif
+
+    vec4 ambient = PositionalAmbientProduct;
+
+    float d = max( dot(L, N), 0.0 );
+    vec4 diffuse = d * PositionalDiffuseProduct;
+
+    float s = pow( max(dot(N, H), 0.0), Shininess );
+    vec4 specular = s * PositionalSpecularProduct;
+
+    if( dot(L, N) < 0.0 ) {
+        specular = vec4(0.0, 0.0, 0.0, 1.0);
     }
-    
-    if (fogFlagOut == 3) {
-        float density = 0.09;
-        vec4 fogColor = vec4(0.7, 0.7, 0.7, 0.5);
-        float fogEquation = exp(-pow(density * z, 2));
-        fColor = mix(fogColor, newColor, clamp(fogEquation, 0.0, 1.0));
+
+    float visibility = (attenuation > 0.0) ? shadow_visibility() : 1.0;
+    return attenuation * (ambient + visibility * (diffuse + specular));
+}
+#endif
+
+void main() 
+{
+    vec4 newColor = color;
+
+#if defined(IS_SHADOW_MAPPED)
+    newColor += positional_light();
+#endif
+
+#if defined(IS_FLOOR) && defined(FLOOR_TEXTURE_FLAG)
+    newColor = newColor * texture( texture_2D, texCoord );
+#endif
+
+#if defined(IS_SPHERE) && defined(SPHERE_TEXTURE_FLAG) && !defined(SPHERE_CHECKER_FLAG)
+    newColor = newColor * texture( texture_1D, texCoord[0] );
+#endif
+
+#if defined(IS_SPHERE) && defined(SPHERE_TEXTURE_FLAG) && defined(SPHERE_CHECKER_FLAG)
+    vec4 texColor = texture( texture_2D, texCoord );
+    if (texColor.x < 0.5) {
+        texColor = vec4(0.9, 0.1, 0.1, 1.0);
     }
-} 
+    newColor = newColor * texColor;
+#endif
 
+#if FOG_FLAG == 1
+    vec4 fogColor = vec4(0.7, 0.7, 0.7, 0.5);
+    float start = 0.0;
+    float end = 18.0;
+    float fogEquation = (end - z) / (end - start);
+    fColor = mix(fogColor, newColor, clamp(fogEquation, 0.0, 1.0));
+#elif FOG_FLAG == 2
+    float density = 0.09;
+    vec4 fogColor = vec4(0.7, 0.7, 0.7, 0.5);
+    float fogEquation = exp(-density * z);
+    fColor = mix(fogColor, newColor, clamp(fogEquation, 0.0, 1.0));
+#elif FOG_FLAG == 3
+    float density = 0.09;
+    vec4 fogColor = vec4(0.7, 0.7, 0.7, 0.5);
+    float fogEquation = exp(-pow(density * z, 2));
+    fColor = mix(fogColor, newColor, clamp(fogEquation, 0.0, 1.0));
+#else
+    fColor = newColor;
+#endif
+} 
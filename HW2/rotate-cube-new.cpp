@@ -25,10 +25,31 @@
    those colors across the triangles.
 **************************************************************/
 #include "Angel-yjc.h"
+#include "ShaderWatcher.h"
+#include "ShaderBuilder.h"
+#include "RenderState.h"
+#include "RenderQueue.h"
+#include "RenderGraph.h"
+#include "FrameTimer.h"
+#include "HeadlessContext.h"
+#include "FramePacer.h"
+#include "TripleBuffer.h"
+#include "RollingPath.h"
+#include "Quaternion.h"
+#include "BallPhysics.h"
+#include "JobSystem.h"
+#include "PlanarShadow.h"
+#include "ShadowMap.h"
+#include "ViewFrustum.h"
+#include "DynamicBVH.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <thread>
 
 #define PI 3.14159
 
@@ -39,7 +60,7 @@ typedef Angel::vec4  point4;
 
 GLuint Angel::InitShader(const char* vShaderFile, const char* fShaderFile);
 
-GLuint program;       /* shader program object id */
+GLuint program;       /* shader program object id currently in use */
 
 // Vertex Buffer Objects
 GLuint cube_buffery;    /* vertex buffer object id for y axis */
@@ -48,13 +69,13 @@ GLuint cube_bufferx;    /* vertex buffer object id for x axis */
 GLuint cube_bufferz;    /* vertex buffer object id for z axis */
 GLuint sphere_buffer;   /* vertex buffer object id for sphere */
 GLuint shadow_buffer;
+GLuint shadowproxy_buffer;  /* vertex buffer object id for the shadow proxy */
 
 // Projection transformation parameters
 GLfloat  fovy = 45.0;  // Field-of-view in Y direction angle (in degrees)
 GLfloat  aspect;       // Viewport aspect ratio
 GLfloat  zNear = 0.5, zFar = 50.0;
 
-GLfloat angle = 0.0; // rotation angle in degrees
 vec4 init_eye(7.0, 3.0, -10.0, 1.0); // initial viewer position
 vec4 eye = init_eye; // current viewer position
 
@@ -67,10 +88,84 @@ int floorFlag = 1;  // 1: solid floor; 0: wireframe floor. Toggled by key 'f' or
 const int cube_NumVertices = 36; // (6 faces)*(2 triangles/face)*(3 vertices/triangle)
 int sphere_NumVertices = 0; // will be changed after reading file input
 
-// flags for rolling segments
-bool flagAB = true;
-bool flagBC = false;
-bool flagCA = false;
+// The path rolled along (see RollingPath.h): the triangle A->B->C->A, or
+// the path read from the file given with --path
+const vec4 rollingPoints[] = {   // A, B and C
+    vec4(-4.0, 1.0,  4.0, 1.0),
+    vec4( 3.0, 1.0, -4.0, 1.0),
+    vec4(-3.0, 1.0, -3.0, 1.0),
+};
+const char* rollingPathFile = NULL;  // --path file
+RollingPath rollingPath;
+
+#define ROLLING_RADIUS  1.0    // radius of the sphere in the sphere files
+
+struct RollingState {
+    double  distance;       // distance rolled, over all the laps of the path
+};
+
+RollingState rolling = { 0.0 };
+
+// The sphere's rotation at each sample of the path's arc-length table, and
+// the axis it rolls about from there to the next sample; the rotation at any
+// distance follows from this table (see init_rolling_path() and
+// rolling_matrix()), whatever the length of the path.
+struct RollingSample {
+    quat    rotation;       // rotation accumulated from the start of the lap
+    vec3    axis;           // axis of rotation up to the next sample
+};
+
+std::vector<RollingSample> rollingSamples;
+double rollingLapAngle = 0.0;          // rotation added by a whole lap: angle in degrees
+vec3 rollingLapAxis(0.0, 1.0, 0.0);    //   about this axis
+
+// Fixed-timestep simulation: the rolling state advances by SIM_ANGLE_STEP
+// degrees of the sphere's rotation (SIM_DISTANCE_STEP along the path) SIM_RATE
+// times per second of real time, whatever the frame rate.
+// In the window it runs on its own thread, simulation_thread(), which owns
+// "rolling" and publishes a SceneSnapshot after every step for display() to
+// render; headless runs step it from the GL thread with simulate_steps().
+#define SIM_RATE        60.0   // simulation steps per second
+#define SIM_ANGLE_STEP  2.0    // degrees rolled per step
+#define SIM_DISTANCE_STEP  (SIM_ANGLE_STEP * PI / 180.0 * ROLLING_RADIUS)
+#define SIM_MAX_GAP     0.25   // seconds; when further behind, skip ahead
+
+struct SceneSnapshot {
+    RollingState  rolling;     // state after the step
+    long          step;        // steps simulated so far
+    std::chrono::steady_clock::time_point time;  // when the step was due
+    std::vector<vec4> ballInstances;  // many balls: ballPhysics.instances()
+    int           ballContacts;       //   and its step statistics
+    double        physicsMs;
+};
+
+TripleBuffer<SceneSnapshot> sceneSnapshots;
+long simStep = 0;
+std::atomic<bool> simRunning(false);  // the simulation thread steps while set
+bool simThreaded = false;             // the simulation thread has been started
+std::atomic<bool> simQuit(false);     // the simulation thread is to end
+std::thread simThread;
+
+// Frame pacing: while animating, a glutTimerFunc() chain wakes up once per
+// frame at the target rate (--fps N, default 60, 0: as fast as possible);
+// otherwise frames are only rendered when something changes.
+FramePacer framePacer;
+int animationTimer = 0;  // id of the running timer chain; changed to stop it
+
+/*----- Many Balls (--balls N) -----*/
+
+// With N > 1 balls, they are rigid bodies rolling on the floor and bouncing
+// off its edges and off each other (see BallPhysics.h), stepped in parallel
+// with the rest of the simulation and drawn in one instanced draw of the
+// sphere mesh. They start out spread over a grid on the floor, each on its
+// own scaled-down copy of the path with its own phase and speed (see
+// init_balls()).
+int ballCount = 1;                     // --balls N
+BallPhysics ballPhysics;
+JobSystem jobSystem;                   // worker threads for ballPhysics
+GLuint instance_buffer;                /* vertex buffer object id for the ball instances */
+long instanceStep = -1;                // simulation step in instance_buffer, -1 if none
+GLfloat ballMotionTime = 0.0;          // seconds the balls are drawn moved on from their step
 
 // flags for menu options
 bool flagPointSourceLight = false;
@@ -80,23 +175,31 @@ bool flagWireframe = false;
 bool flagLighting = true;
 int fogFlag = 0; // 0: no fog; 1: linear fog; 2: exponential fog; 3: exponential square fog
 bool shadowblendFlag = true;
+bool flagShadowProxy = true;  // true: filled shadows of the low-poly shadow proxy
+bool flagStencilShadow = true; // true: floor drawn once, shadow clipped by stencil;
+                               // false: floor drawn twice around the shadow
+bool flagShadowMap = false;    // true: spotlight shadows from shadowMap instead
 int floortextureFlag = 1;
 int verticalFlag = 0;
 int eyeFlag = 0;
 int sphereCheckerFlag = 1;
 int spheretextureFlag = 1;
 
-// matrix M
-mat4 totalRotation(vec4(1.0, 0.0, 0.0, 0.0),
-                   vec4(0.0, 1.0, 0.0, 0.0),
-                   vec4(0.0, 0.0, 1.0, 0.0),
-                   vec4(0.0, 0.0, 0.0, 1.0));
-
-// shadow matrix
-mat4 shadowMat(vec4(12.0,  0.0,  0.0, 182.0),
-               vec4( 0.0,  0.0,  0.0,   0.0),
-               vec4( 0.0,  0.0, 12.0,  39.0),
-               vec4( 0.0, -1.0,  0.0,  12.0));
+// shadow projections from light_position onto the receiving planes
+// (the floor); see init_shadow_planes()
+PlanarShadow planarShadow;
+int floorShadowPlane;       // the floor's plane in planarShadow
+
+// shadow mapping: the depth of the casters seen from the light, re-rendered
+// only when they or the light have moved; see update_shadow_map()
+#define SHADOW_MAP_UNIT   GL_TEXTURE2   // texture units 0 and 1: floor and sphere
+ShadowMap shadowMap;
+int shadowMapSize = SHADOW_MAP_DEFAULT_SIZE;   // --shadow-map-size N
+mat4 shadowCasterMat;            // sphere pose in the map
+long shadowCasterStep = -1;      // many balls: simulation step in the map,
+GLfloat shadowCasterTime = 0.0;  //   and ballMotionTime
+bool shadowMapRendered = false;  // rendered for the current frame
+double shadowMapMs = 0.0;        //   in this CPU time
 
 // y axis
 #if 0
@@ -107,24 +210,36 @@ vec3 cube_colorsy[cube_NumVertices]; // colors for all vertices
 point3 cube_pointsy[100];
 vec3 cube_colorsy[100];
 #endif
+BoundingSphere cube_boundsy;   // bounding sphere of cube_pointsy
 
 // x axis
 point3 cube_pointsx[100];
 vec3 cube_colorsx[100];
+BoundingSphere cube_boundsx;
 
 // z axis
 point3 cube_pointsz[100];
 vec3 cube_colorsz[100];
+BoundingSphere cube_boundsz;
 
 // floor
 const int floor_NumVertices = 6; //(1 face)*(2 triangles/face)*(3 vertices/triangle)
 point3 floor_points[floor_NumVertices]; // positions for all vertices
 vec3 floor_normals[floor_NumVertices];
+BoundingSphere floor_bounds;
 
 // sphere
 point3 sphere_points[1000000];
 vec3 sphere_normals_flat[1000000];
 vec3 sphere_normals_smooth[1000000];
+BoundingSphere sphere_bounds;  // of sphere_points, in the object frame
+
+// shadow proxy: a coarse unit sphere standing in for the sphere in its
+// (flat, single-coloured) shadow, whatever the resolution of the sphere file
+#define SHADOW_PROXY_SLICES  16
+#define SHADOW_PROXY_STACKS  8
+const int shadowProxy_NumVertices = 6 * SHADOW_PROXY_SLICES * (SHADOW_PROXY_STACKS - 1);
+point3 shadowProxy_points[shadowProxy_NumVertices];
 
 #define ImageWidth  32
 #define ImageHeight 32
@@ -202,8 +317,219 @@ vec2 floor_texCoord[6] = {
     vec2(0.0, 0.0)
 };
 
-// Model-view and projection matrices uniform location
-GLuint  model_view, projection;
+/*----- Uniform Buffer Objects -----*/
+
+// Binding points of the std140 uniform blocks declared in the shaders
+#define LIGHTING_BLOCK_BINDING  0
+#define MATERIAL_BLOCK_BINDING  1
+#define TRANSFORM_BLOCK_BINDING 2
+
+// Objects that own a material block (replaces the "floor", "sphere", ... strings)
+enum { MAT_FLOOR, MAT_SPHERE, MAT_SHADOW, MAT_XAXIS, MAT_YAXIS, MAT_ZAXIS, NumMaterials };
+
+// Per-frame lighting block: light parameters.
+// Must match "LightingBlock" in vshader42.glsl (std140).
+struct LightingBlock {
+    vec4    DirectionalLightDirection;
+    vec4    LightPosition;        // in eye frame
+    vec4    SpotLightDirection;   // in eye frame
+    GLfloat ConstAtt, LinearAtt, QuadAtt, ExpVal;
+    GLfloat CutoffAngle, pad[3];
+    mat4    ShadowMatrix;         // eye frame to shadow map, row-major
+};
+
+// Per-material block: light*material products.
+// Must match "MaterialBlock" in vshader42.glsl (std140).
+struct MaterialBlock {
+    color4  GlobalAmbientProduct;
+    color4  PositionalAmbientProduct, PositionalDiffuseProduct, PositionalSpecularProduct;
+    color4  DirectionalAmbientProduct, DirectionalDiffuseProduct, DirectionalSpecularProduct;
+    GLfloat Shininess, pad[3];
+};
+
+// Per-draw transform block. Declared row_major in the shader so that the
+// row-major mat4 of mat-yjc-new.h can be copied as is; each mat3 row is
+// padded to a vec4 as std140 requires.
+struct TransformBlock {
+    mat4    model_view;
+    mat4    projection;
+    vec4    Normal_Matrix[3];
+    GLfloat MotionTime, pad[3];
+};
+
+GLuint lighting_ubo;                 /* uniform buffer object id for LightingBlock */
+GLuint material_ubo[NumMaterials];   /* one MaterialBlock buffer per object */
+GLuint transform_ubo;                /* uniform buffer object id for TransformBlock */
+
+// Set by the menu/keyboard callbacks; the block is re-uploaded on the next draw.
+bool lightingDirty = true;
+bool materialDirty = true;
+
+TransformBlock lastTransform;        // last TransformBlock contents sent to the GPU
+bool transformValid = false;         // false until lastTransform has been uploaded
+
+/*----- Shader Permutations -----*/
+
+// A permutation key packs the object (MAT_FLOOR, ...) in its low 3 bits and
+// the options below that change the shader code for that object. Options
+// that do not affect an object are left out of its key, so e.g. the axes
+// only ever need one program per fog mode.
+#define PERM_LIGHTING         (1 << 3)
+#define PERM_POINT_SOURCE     (1 << 4)
+#define PERM_SPOTLIGHT        (1 << 5)
+#define PERM_SPHERE_TEXTURE   (1 << 6)
+#define PERM_SPHERE_CHECKER   (1 << 7)
+#define PERM_VERTICAL         (1 << 8)
+#define PERM_EYE              (1 << 9)
+#define PERM_FLOOR_TEXTURE    (1 << 10)
+#define PERM_FOG_SHIFT        11        // 2 bits: fogFlag
+#define PERM_INSTANCED        (1 << 13) // per-instance model matrices
+#define PERM_SHADOW_MAP       (1 << 14) // positional light tested against shadowMap
+#define NumPermutations       (1 << 15)
+
+// Shader program for each permutation key; 0 until first used.
+GLuint programTable[NumPermutations];
+// Permutations that failed to build from the current shader files; they are
+// not tried again until the files change
+bool programFailed[NumPermutations];
+
+// Shader hot reload: the builds from the changed shader files of every
+// program in use, and the programs done so far, swapped into programTable
+// together once all of them are done. The builds run alongside the frames
+// (see ShaderBuilder.h), which are only polled for them.
+const char* shaderFiles[2] = { "vshader42.glsl", "fshader42.glsl" };
+bool shaderWatching = false;  // the shader watcher is running
+vector<pair<unsigned, int> > reloadBuilds;       // key and build id, not yet done
+vector<pair<unsigned, GLuint> > reloadPrograms;  // key and program, done
+chrono::steady_clock::time_point reloadStart;
+int reloadFrames = 0;         // frames drawn so far during the current reload
+double reloadMs = 0.0;        // time spent on it so far in those frames
+
+/*----- Render Graph -----*/
+
+// Logical resources produced and consumed by the passes of a frame
+enum {
+    RES_FLOOR_COLOR   = 1 << 0,   // floor colour in the color buffer
+    RES_SHADOW        = 1 << 1,   // shadow decal blended onto the floor colour
+    RES_FLOOR_DEPTH   = 1 << 2,   // floor in the depth buffer
+    RES_FLOOR_STENCIL = 1 << 3,   // visible floor marked in the stencil buffer
+    RES_SCENE         = 1 << 4,   // sphere and axes, color and depth
+};
+
+// Passes of a frame, as declared to renderGraph (the pass ids are the indices).
+// Only the passes of the selected shadow method receive draws.
+enum { PASS_FLOOR, PASS_SHADOW, PASS_FLOOR_DEPTH, PASS_FLOOR_STENCIL, PASS_SHADOW_STENCIL,
+       PASS_SPHERE, PASS_AXES, NumPasses };
+
+// Two-pass method: the shadow is drawn with GL_LESS at the depth of the floor,
+// so the floor depth must be written after the floor colour and the shadow.
+// Stencil method: the floor is drawn once and marks the stencil; the shadow is
+// drawn without depth test where marked, clearing the mark so that overlapping
+// shadow triangles blend only once. It must precede the sphere and axes. The
+// receiver of shadow plane i marks i + 1, which only the shadow on plane i
+// tests for (the stencilRef of their draws).
+RenderPassDesc renderPasses[NumPasses] = {
+    // name             inputs             afterInputs                   outputs
+    //                  depth test/mask  color    stencil
+    { "floor",          0,                 0,                            RES_FLOOR_COLOR,
+                        GL_TRUE, GL_FALSE, GL_TRUE,  STENCIL_OFF  },
+    { "shadow",         RES_FLOOR_COLOR,   0,                            RES_SHADOW,
+                        GL_TRUE, GL_FALSE, GL_TRUE,  STENCIL_OFF  },
+    { "floor-depth",    0,                 RES_FLOOR_COLOR | RES_SHADOW, RES_FLOOR_DEPTH,
+                        GL_TRUE, GL_TRUE,  GL_FALSE, STENCIL_OFF  },
+    { "floor-stencil",  0,                 0,   RES_FLOOR_COLOR | RES_FLOOR_DEPTH | RES_FLOOR_STENCIL,
+                        GL_TRUE, GL_TRUE,  GL_TRUE,  STENCIL_MARK },
+    { "shadow-stencil", RES_FLOOR_STENCIL, 0,                            RES_SHADOW,
+                        GL_FALSE, GL_FALSE, GL_TRUE, STENCIL_ONCE },
+    { "sphere",         RES_FLOOR_DEPTH,   RES_SHADOW,                   RES_SCENE,
+                        GL_TRUE, GL_TRUE,  GL_TRUE,  STENCIL_OFF  },
+    { "axes",           RES_FLOOR_DEPTH,   RES_SHADOW,                   RES_SCENE,
+                        GL_TRUE, GL_TRUE,  GL_TRUE,  STENCIL_OFF  },
+};
+
+RenderGraph renderGraph;
+
+// GL_SAMPLES_PASSED queries of the slots of a frame, while statistics are
+// on. Like the timer queries of FrameTimer, they are read SAMPLE_QUERY_FRAMES
+// frames later, when they are normally available, so that reading them does
+// not wait for the GPU
+#define SAMPLE_QUERY_FRAMES  3
+struct SampleQuerySet {
+    GLuint  queries[NumPasses];       // one per slot
+    int     frame;                    // frame that ran them, -1 if none
+    int     numSlots;
+    string  slotName[NumPasses];
+};
+SampleQuerySet sampleQuerySets[SAMPLE_QUERY_FRAMES];
+int sampleQueryFrame = 0;            // frames run with statistics on
+int samplesFrame = -1;               // latest of those frames read, -1 if none yet
+vector<string> samplesSlotName;      //   its slots
+vector<long> samplesPassed;          //   and their samples; -1 if not available
+int windowWidth = 0, windowHeight = 0;
+
+// CPU/GPU time of each slot and of the buffer swap, while statistics are on
+FrameTimer frameTimer;
+const char* frameTimingFile = "frametimes.csv";  // written on exit
+
+/*----- Headless Rendering (--headless N) -----*/
+
+int headlessFrames = 0;              // > 0: render this many frames offscreen, then exit
+int headlessWidth = 512, headlessHeight = 512;   // --size WxH
+const char* headlessOutput = NULL;   // --output file.ppm: last frame
+long headlessStart = 0;              // --start N: begin at simulation step N
+bool headlessShadowCheck = false;    // --shadow-check: see check_shadow_proxy()
+
+// glutPostRedisplay(), except headless where there is no window to redisplay
+void post_redisplay()
+{
+    if (headlessFrames == 0)
+        glutPostRedisplay();
+}
+
+/*----- Render Queue -----*/
+
+RenderQueue renderQueue;
+
+// View frustum culling: draws whose bounds are outside viewFrustum are not
+// queued at all. Counts of the current frame:
+ViewFrustum viewFrustum;             // world frame, from Perspective() * LookAt()
+int drawsCulled = 0;                 // draws left out by viewFrustum
+int drawsDrawn = 0;                  // draws executed
+
+// Many balls: the sphere draw only has the balls whose bounds ballTree finds
+// inside viewFrustum; the tree is refit to the balls of each new simulation
+// step. See cull_balls()
+DynamicBVH ballTree;
+long ballTreeStep = -1;              // simulation step of the bounds in ballTree
+std::vector<int> visibleBalls;       // ballTree.cull() of the current frame
+std::vector<vec4> visibleInstances;  //   their instance rows
+GLuint visible_instance_buffer;      /* vertex buffer object id for visibleInstances */
+long visibleStep = -1;               // simulation step and view-projection of
+mat4 visibleViewProjection;          //   visibleInstances; -1 if none
+double ballRefitMs = 0.0;            // CPU time of the refit, current frame
+double ballCullMs = 0.0;             //   and of the cull
+
+// Many balls: the shadow draw on each receiving plane only has the balls
+// whose shadows on it are inside viewFrustum, found with a tree over their
+// shadow bounds on that plane (PlanarShadow::shadowBounds()). A ball whose
+// shadow has no bounds is always drawn. See cull_ball_shadows()
+struct BallShadows {
+    DynamicBVH tree;                 // shadow bounds; a ball's own if none
+    std::vector<char> unbounded;     // by ball: its shadow has no bounds
+    std::vector<int> unboundedBalls; //   the balls whose shadows have none
+    std::vector<int> visible;        // balls drawn
+    std::vector<vec4> instances;     //   their instance rows
+    GLuint buffer;                   /* vertex buffer object id for instances */
+    long step;                       // simulation step, projection and
+    mat4 projection;                 //   view-projection of the tree and of
+    mat4 viewProjection;             //   instances; step -1 if none
+};
+std::vector<BallShadows> ballShadows;  // by plane of planarShadow
+double ballShadowRefitMs = 0.0;      // CPU time of the refits, current frame
+double ballShadowCullMs = 0.0;       //   and of the culls
+
+int uniformUploadBytes = 0;          // uniform bytes sent to the GPU in the current frame
+int statsFlag = 0;                   // 1: print frame statistics. Toggled by key 'i' or 'I'
 
 /*----- Shader Lighting Parameters -----*/
 
@@ -238,7 +564,9 @@ color4 sphere_material_diffuse( 1.0, 0.84, 0.0, 1.0 );
 color4 sphere_material_specular( 1.0, 0.84, 0.0, 1.0 );
 float  sphere_material_shininess = 125.0;
 
-void SetUp_Lighting_Uniform_Vars(mat4 mv, string object);
+void SetUp_Lighting_Uniform_Vars(mat4 mv);
+void SetUp_Material_Uniform_Vars(int object);
+void SetUp_Transform_Uniform_Vars(mat4 mv, mat4 p);
 
 //----------------------------------------------------------------------------
 int Index = 0; // YJC: This must be a global variable since quad() is called
@@ -279,6 +607,54 @@ void floor()
     floor_normals[3] = vec3(0.0, 1.0, 0.0); floor_points[3] = floor_vertices[2];
     floor_normals[4] = vec3(0.0, 1.0, 0.0); floor_points[4] = floor_vertices[1];
     floor_normals[5] = vec3(0.0, 1.0, 0.0); floor_points[5] = floor_vertices[0];
+    floor_bounds = ComputeBoundingSphere(floor_points, floor_NumVertices);
+}
+//----------------------------------------------------------------------------
+// init_shadow_planes():
+//   register the planes that receive the shadows, here the plane of the
+//   floor, from its normal and one of its corners. Another receiver is one
+//   more planarShadow.addPlane(), and its geometry drawn in the floor-stencil
+//   pass with stencil ref i + 1, i being its plane; the shadow on plane i is
+//   clipped to that mark (at most 255 planes with 8 stencil bits).
+//
+void init_shadow_planes()
+{
+    vec3 normal = floor_normals[0];
+    floorShadowPlane = planarShadow.addPlane(vec4(normal.x, normal.y, normal.z,
+                                                  -dot(normal, floor_vertices[0])));
+    planarShadow.setLight(light_position);
+}
+//----------------------------------------------------------------------------
+// shadow_proxy():
+//   generate the triangles of the shadow proxy, a unit sphere of
+//   SHADOW_PROXY_STACKS bands of SHADOW_PROXY_SLICES slices.
+//
+point3 proxy_point(int stack, int slice)
+{
+    GLfloat theta = PI * stack / SHADOW_PROXY_STACKS;
+    GLfloat phi = 2.0 * PI * slice / SHADOW_PROXY_SLICES;
+    return point3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+void shadow_proxy()
+{
+    int index = 0;
+    for (int stack = 0; stack < SHADOW_PROXY_STACKS; stack++)
+        for (int slice = 0; slice < SHADOW_PROXY_SLICES; slice++) {
+            point3 a = proxy_point(stack, slice), b = proxy_point(stack, slice + 1);
+            point3 c = proxy_point(stack + 1, slice), d = proxy_point(stack + 1, slice + 1);
+
+            if (stack > 0) {  // the top band has one triangle per slice, at the pole
+                shadowProxy_points[index++] = a;
+                shadowProxy_points[index++] = c;
+                shadowProxy_points[index++] = b;
+            }
+            if (stack < SHADOW_PROXY_STACKS - 1) {  // and so has the bottom band
+                shadowProxy_points[index++] = b;
+                shadowProxy_points[index++] = c;
+                shadowProxy_points[index++] = d;
+            }
+        }
 }
 
 void setspherenormals() {
@@ -349,11 +725,542 @@ void image_set_up(void)
 
 } /* end function */
 
+//----------------------------------------------------------------------------
+// init_uniform_blocks():
+//   create the uniform buffer objects and attach them to their binding points.
+//
+void init_uniform_blocks()
+{
+    glGenBuffers(1, &lighting_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, lighting_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightingBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTING_BLOCK_BINDING, lighting_ubo);
+
+    glGenBuffers(NumMaterials, material_ubo);
+    for (int i = 0; i < NumMaterials; i++) {
+        glBindBuffer(GL_UNIFORM_BUFFER, material_ubo[i]);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(MaterialBlock), NULL, GL_DYNAMIC_DRAW);
+    }
+
+    glGenBuffers(1, &transform_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, transform_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(TransformBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, TRANSFORM_BLOCK_BINDING, transform_ubo);
+
+    lightingDirty = true;
+    materialDirty = true;
+    transformValid = false;
+}
+
+//----------------------------------------------------------------------------
+// shader_permutation(object, instanced):
+//   return the permutation key for drawing "object" with the current options,
+//   as an instanced draw if "instanced".
+//
+unsigned shader_permutation(int object, bool instanced = false)
+{
+    unsigned key = object;
+
+    if (instanced)
+        key |= PERM_INSTANCED;
+
+    bool isLit = (object == MAT_FLOOR && flagLighting) ||
+                 (object == MAT_SPHERE && flagLighting && !flagWireframe);
+    if (isLit) {
+        key |= PERM_LIGHTING;
+        if (flagPointSourceLight) key |= PERM_POINT_SOURCE;
+        if (flagSpotlightLight)   key |= PERM_SPOTLIGHT;
+        if (flagShadow && flagShadowMap) key |= PERM_SHADOW_MAP;
+    }
+
+    if (object == MAT_SPHERE && spheretextureFlag == 1) {
+        key |= PERM_SPHERE_TEXTURE;
+        if (sphereCheckerFlag == 1) key |= PERM_SPHERE_CHECKER;
+        if (verticalFlag == 1)      key |= PERM_VERTICAL;
+        if (eyeFlag == 1)           key |= PERM_EYE;
+    }
+
+    if (object == MAT_FLOOR && floortextureFlag == 1)
+        key |= PERM_FLOOR_TEXTURE;
+
+    key |= fogFlag << PERM_FOG_SHIFT;
+
+    return key;
+}
+
+//----------------------------------------------------------------------------
+// shader_permutation_preamble(key):
+//   the #defines that specialize vshader42.glsl/fshader42.glsl for "key".
+//
+string shader_permutation_preamble(unsigned key)
+{
+    static const char* objectDefines[NumMaterials] = {
+        "IS_FLOOR", "IS_SPHERE", "IS_SHADOW", "IS_AXIS_X", "IS_AXIS_Y", "IS_AXIS_Z"
+    };
+
+    string preamble = string("#define ") + objectDefines[key & 7] + "\n";
+    if (key & PERM_LIGHTING)       preamble += "#define IS_LIGHTING\n";
+    if (key & PERM_POINT_SOURCE)   preamble += "#define IS_POINT_SOURCE\n";
+    if (key & PERM_SPOTLIGHT)      preamble += "#define IS_SPOTLIGHT\n";
+    if (key & PERM_SPHERE_TEXTURE) preamble += "#define SPHERE_TEXTURE_FLAG\n";
+    if (key & PERM_SPHERE_CHECKER) preamble += "#define SPHERE_CHECKER_FLAG\n";
+    if (key & PERM_VERTICAL)       preamble += "#define VERTICAL_FLAG\n";
+    if (key & PERM_EYE)            preamble += "#define EYE_FLAG\n";
+    if (key & PERM_FLOOR_TEXTURE)  preamble += "#define FLOOR_TEXTURE_FLAG\n";
+    if (key & PERM_INSTANCED)      preamble += "#define IS_INSTANCED\n";
+    if (key & PERM_SHADOW_MAP)     preamble += "#define IS_SHADOW_MAPPED\n";
+    preamble += "#define FOG_FLAG " + to_string(key >> PERM_FOG_SHIFT) + "\n";
+    return preamble;
+}
+
+//----------------------------------------------------------------------------
+// setup_shader_permutation(prog):
+//   bind the uniform blocks and samplers of a newly built program.
+//
+void setup_shader_permutation(GLuint prog)
+{
+    // A block that a permutation does not use is optimized away (GL_INVALID_INDEX)
+    GLuint index = glGetUniformBlockIndex(prog, "LightingBlock");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(prog, index, LIGHTING_BLOCK_BINDING);
+    index = glGetUniformBlockIndex(prog, "MaterialBlock");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(prog, index, MATERIAL_BLOCK_BINDING);
+    index = glGetUniformBlockIndex(prog, "TransformBlock");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(prog, index, TRANSFORM_BLOCK_BINDING);
+
+    // Texture units never change, so the samplers are set once here
+    UseProgram(prog);
+    glUniform1i( glGetUniformLocation(prog, "texture_2D"), 0 );
+    glUniform1i( glGetUniformLocation(prog, "texture_1D"), 1 );
+    glUniform1i( glGetUniformLocation(prog, "shadow_map"), SHADOW_MAP_UNIT - GL_TEXTURE0 );
+}
+
+//----------------------------------------------------------------------------
+// build_shader_permutation(key, noExit):
+//   compile and link vshader42.glsl/fshader42.glsl specialized for "key".
+//   With "noExit" (the shader files are being edited), a shader error
+//   returns 0 instead of exiting.
+//
+GLuint build_shader_permutation(unsigned key, bool noExit)
+{
+    string preamble = shader_permutation_preamble(key);
+
+    printf("Building shader permutation 0x%04x\n", key);
+    GLuint prog;
+    if (noExit) {
+        prog = TryInitShader(shaderFiles[0], shaderFiles[1], preamble.c_str());
+        if (prog == 0) return 0;
+    }
+    else
+        prog = InitShader(shaderFiles[0], shaderFiles[1], preamble.c_str());
+
+    setup_shader_permutation(prog);
+    return prog;
+}
+
+//----------------------------------------------------------------------------
+// use_shader_permutation(object, instanced):
+//   make the program specialized for drawing "object" with the current
+//   options the one in use, building it first if needed. While the shader
+//   files are watched, a shader error does not exit: false is returned, and
+//   the caller skips its draw.
+//
+bool use_shader_permutation(int object, bool instanced = false)
+{
+    unsigned key = shader_permutation(object, instanced);
+
+    if (programTable[key] == 0) {
+        if (programFailed[key])
+            return false;
+        programTable[key] = build_shader_permutation(key, shaderWatching);
+        if (programTable[key] == 0) {
+            printf("Shader permutation 0x%04x failed to build, skipping its draws\n", key);
+            programFailed[key] = true;
+            return false;
+        }
+    }
+
+    program = programTable[key];
+    UseProgram(program);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// drop_shader_reload():
+//   cancel the builds of an unfinished reload and delete its programs.
+//
+void drop_shader_reload()
+{
+    CancelShaderBuilds();
+    reloadBuilds.clear();
+    for (size_t i = 0; i < reloadPrograms.size(); i++)
+        glDeleteProgram(reloadPrograms[i].second);
+    reloadPrograms.clear();
+}
+
+//----------------------------------------------------------------------------
+// poll_shader_reload():
+//   collect the reload builds done since the last frame; once all of them
+//   are, swap their programs in. If the new sources fail to compile, the
+//   current programs are all kept and the rest of the reload is dropped, so
+//   that programs of the old and new sources are never mixed.
+//
+void poll_shader_reload()
+{
+    if (reloadBuilds.empty()) return;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    reloadFrames++;
+    for (size_t i = 0; i < reloadBuilds.size(); ) {
+        GLuint prog = 0;
+        int status = PollShaderBuild(reloadBuilds[i].second, &prog);
+        if (status == SHADER_BUILD_FAILED) {
+            printf("Shader reload failed, keeping the previous programs\n");
+            drop_shader_reload();
+            return;
+        }
+        if (status == SHADER_BUILD_DONE) {
+            setup_shader_permutation(prog);
+            reloadPrograms.push_back(make_pair(reloadBuilds[i].first, prog));
+            reloadBuilds.erase(reloadBuilds.begin() + i);
+        }
+        else
+            i++;
+    }
+    reloadMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    if (!reloadBuilds.empty()) {
+        post_redisplay(); // keep polling while paused
+        return;
+    }
+
+    for (size_t i = 0; i < reloadPrograms.size(); i++) {
+        glDeleteProgram(programTable[reloadPrograms[i].first]);
+        programTable[reloadPrograms[i].first] = reloadPrograms[i].second;
+    }
+    double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now()
+                                                     - reloadStart).count();
+    printf("Shader reload done: %d programs in %.2f ms over %d frames, "
+           "%.2f ms of them on the GL thread (%s)\n\n", (int) reloadPrograms.size(),
+           totalMs, reloadFrames, reloadMs, ShaderBuilderMode());
+    reloadPrograms.clear();
+}
+
+//----------------------------------------------------------------------------
+// shader_watch_timer():
+//   GLUT timer callback; starts rebuilding every built program when the
+//   shader watcher has seen a change, then re-arms itself.
+//
+void shader_watch_timer(int value)
+{
+    if (ShaderFilesChanged()) {
+        drop_shader_reload();
+        memset(programFailed, 0, sizeof(programFailed));  // the new files may build
+
+        reloadStart = chrono::steady_clock::now();
+        for (unsigned key = 0; key < NumPermutations; key++)
+            if (programTable[key] != 0) {
+                int build = StartShaderBuild(shaderFiles[0], shaderFiles[1],
+                                             shader_permutation_preamble(key));
+                reloadBuilds.push_back(make_pair(key, build));
+            }
+        reloadFrames = 0;
+        reloadMs = chrono::duration<double, milli>(chrono::steady_clock::now()
+                                                   - reloadStart).count();
+        printf("Shader files changed, rebuilding %d programs\n", (int) reloadBuilds.size());
+        post_redisplay();
+    }
+    glutTimerFunc(250, shader_watch_timer, 0);
+}
+
+//----------------------------------------------------------------------------
+// rolling_pose(state, position, tangent):
+//   the sphere's rotation for "state", and its center and direction of
+//   motion: a binary search of the path's arc-length table, then the
+//   rotation from that sample on.
+//
+quat rolling_pose(const RollingState& state, vec4& position, vec4& tangent)
+{
+    double laps = floor(state.distance / rollingPath.length());
+    GLfloat s = state.distance - laps * rollingPath.length();
+
+    rollingPath.evaluate(s, position, tangent);
+
+    int i = rollingPath.findSample(s);
+    const RollingSample& sample = rollingSamples[i];
+    GLfloat angle = (s - rollingPath.sampleDistance(i)) / ROLLING_RADIUS * 180.0 / PI;
+    quat rotation = AxisAngle(angle, sample.axis.x, sample.axis.y, sample.axis.z)
+                    * sample.rotation;
+
+    // Whole laps as one rotation by n times the lap's angle rather than a
+    // product of n rotations
+    if (laps > 0.0)
+        rotation = rotation * AxisAngle(fmod(laps * rollingLapAngle, 360.0),
+                                        rollingLapAxis.x, rollingLapAxis.y, rollingLapAxis.z);
+
+    return normalize(rotation);
+}
+
+//----------------------------------------------------------------------------
+// rolling_matrix(state):
+//   the sphere's model matrix for "state".
+//
+mat4 rolling_matrix(const RollingState& state)
+{
+    vec4 position, tangent;
+    quat rotation = rolling_pose(state, position, tangent);
+    return Translate(position) * Rotate(rotation);
+}
+
+//----------------------------------------------------------------------------
+// init_rolling_path():
+//   set up rollingPath, from rollingPathFile if given, and roll once along
+//   it to fill rollingSamples; exits if the file cannot be used.
+//
+void init_rolling_path()
+{
+    if (rollingPathFile == NULL)
+        rollingPath.set(RollingPath::POLYLINE,
+                        vector<vec4>(rollingPoints, rollingPoints + 3));
+    else if (!rollingPath.load(rollingPathFile))
+        exit(1);
+
+    vec4 up(0.0, 1.0, 0.0, 0.0);
+    int numSamples = rollingPath.numSamples();
+    rollingSamples.resize(numSamples);
+
+    // Between two samples the sphere rolls along their chord, about the
+    // horizontal axis across it; renormalized at each sample, the rotation
+    // does not drift however many samples the path has
+    quat rotation;
+    vec4 from, to, tangent;
+    rollingPath.evaluate(0.0, from, tangent);
+    for (int i = 0; i + 1 < numSamples; i++) {
+        rollingPath.evaluate(rollingPath.sampleDistance(i + 1), to, tangent);
+        vec4 axis = cross(up, to - from);
+        if (length(axis) == 0.0)
+            axis = vec4(1.0, 0.0, 0.0, 0.0);
+
+        rollingSamples[i].rotation = rotation;
+        rollingSamples[i].axis = vec3(axis.x, axis.y, axis.z);
+
+        GLfloat span = rollingPath.sampleDistance(i + 1) - rollingPath.sampleDistance(i);
+        rotation = normalize(AxisAngle(span / ROLLING_RADIUS * 180.0 / PI,
+                                       axis.x, axis.y, axis.z) * rotation);
+        from = to;
+    }
+    rollingSamples[numSamples - 1].rotation = rotation;
+    rollingSamples[numSamples - 1].axis = rollingSamples[numSamples - 2].axis;
+
+    // The lap's rotation as an angle about an axis (see rolling_matrix())
+    ToAxisAngle(rotation, rollingLapAngle, rollingLapAxis);
+}
+
+//----------------------------------------------------------------------------
+// rolling_state_at(steps):
+//   the rolling state after "steps" simulation steps (possibly fractional).
+//
+RollingState rolling_state_at(double steps)
+{
+    RollingState state = { steps * SIM_DISTANCE_STEP };
+    return state;
+}
+
+//----------------------------------------------------------------------------
+// publish_snapshot(time):
+//   publish "rolling" as the newest scene snapshot, stepped at "time".
+//
+void publish_snapshot(std::chrono::steady_clock::time_point time)
+{
+    SceneSnapshot& snapshot = sceneSnapshots.back();
+    snapshot.rolling = rolling;
+    snapshot.step = simStep;
+    snapshot.time = time;
+    if (ballCount > 1) {
+        snapshot.ballInstances = ballPhysics.instances();
+        snapshot.ballContacts = ballPhysics.contacts();
+        snapshot.physicsMs = ballPhysics.stepMs();
+    }
+    sceneSnapshots.publish();
+}
+
+//----------------------------------------------------------------------------
+// simulate_steps(steps):
+//   advance the simulation by "steps" fixed steps, in one jump, and publish
+//   the result; only while the simulation thread is not running.
+//
+void simulate_steps(long steps)
+{
+    for (long i = 0; i < steps && ballCount > 1; i++)
+        ballPhysics.step(1.0 / SIM_RATE, jobSystem);
+    simStep += steps;
+    rolling = rolling_state_at(simStep);
+    publish_snapshot(chrono::steady_clock::now());
+}
+
+//----------------------------------------------------------------------------
+// simulation_thread():
+//   step the simulation SIM_RATE times per second while simRunning is set,
+//   until simQuit is set.
+//
+void simulation_thread()
+{
+    typedef chrono::steady_clock Clock;
+    Clock::duration step = chrono::duration_cast<Clock::duration>(
+                               chrono::duration<double>(1.0 / SIM_RATE));
+    Clock::duration maxGap = chrono::duration_cast<Clock::duration>(
+                                 chrono::duration<double>(SIM_MAX_GAP));
+    Clock::time_point next = Clock::now();
+
+    while (!simQuit) {
+        if (!simRunning) {
+            this_thread::sleep_for(chrono::milliseconds(20));
+            next = Clock::now();
+            continue;
+        }
+
+        next += step;
+        this_thread::sleep_until(next);
+        if (Clock::now() - next > maxGap)
+            next = Clock::now();
+
+        if (ballCount > 1)
+            ballPhysics.step(1.0 / SIM_RATE, jobSystem);
+        simStep++;
+        rolling = rolling_state_at(simStep);
+        publish_snapshot(next);
+    }
+}
+
+//----------------------------------------------------------------------------
+// stop_simulation_thread():
+//   atexit() handler; end the simulation thread before the scene it steps
+//   is destroyed.
+//
+void stop_simulation_thread()
+{
+    simQuit = true;
+    simThread.join();
+}
+
+//----------------------------------------------------------------------------
+void start_simulation_thread()
+{
+    simThreaded = true;
+    simThread = thread(simulation_thread);
+    atexit(stop_simulation_thread);
+}
+
+//----------------------------------------------------------------------------
+// snapshot_fraction(snapshot):
+//   the fraction of a step elapsed between the step of "snapshot" and now,
+//   in [0, 1]; 0 unless the simulation thread is running.
+//
+double snapshot_fraction(const SceneSnapshot& snapshot)
+{
+    if (!simThreaded || !simRunning)
+        return 0.0;
+
+    double fraction = chrono::duration<double>(chrono::steady_clock::now()
+                                               - snapshot.time).count() * SIM_RATE;
+    return min(max(fraction, 0.0), 1.0);
+}
+
+//----------------------------------------------------------------------------
+// rolling_frame_state(snapshot):
+//   the rolling state at the current time, from the scene snapshot of the
+//   frame and the time elapsed since its step. The motion has no input,
+//   so the state between that step and the next is known exactly and is
+//   rendered instead of lagging a step behind.
+//
+RollingState rolling_frame_state(const SceneSnapshot& snapshot)
+{
+    RollingState state = snapshot.rolling;
+    state.distance += snapshot_fraction(snapshot) * SIM_DISTANCE_STEP;
+    return state;
+}
+
+//----------------------------------------------------------------------------
+// init_balls():
+//   set up ballPhysics with ballCount balls on the floor, one per cell of a
+//   grid, each where it would be on a copy of the path scaled down to the
+//   cell; nothing to do for a single ball. rollingPath must be set up.
+//
+void init_balls()
+{
+    if (ballCount <= 1)
+        return;
+
+    GLfloat floorX0 = floor_vertices[0].x, floorX1 = floor_vertices[0].x;
+    GLfloat floorZ0 = floor_vertices[0].z, floorZ1 = floor_vertices[0].z;
+    for (int i = 1; i < 4; i++) {
+        floorX0 = min(floorX0, floor_vertices[i].x);
+        floorX1 = max(floorX1, floor_vertices[i].x);
+        floorZ0 = min(floorZ0, floor_vertices[i].z);
+        floorZ1 = max(floorZ1, floor_vertices[i].z);
+    }
+
+    // footprint of the path on the floor, sphere included
+    vec4 low = rollingPath.low(), high = rollingPath.high();
+    GLfloat pathWidth = high.x - low.x + 2.0 * ROLLING_RADIUS;
+    GLfloat pathDepth = high.z - low.z + 2.0 * ROLLING_RADIUS;
+    vec4 pathCenter((low.x + high.x) / 2.0, 0.0, (low.z + high.z) / 2.0, 0.0);
+
+    // about square cells; scaling the path and the sphere alike leaves the
+    // rotation at each point of the path unchanged
+    GLfloat floorWidth = floorX1 - floorX0, floorDepth = floorZ1 - floorZ0;
+    int columns = max(1, (int) ceil(sqrt(ballCount * floorWidth / floorDepth)));
+    int rows = (ballCount + columns - 1) / columns;
+    GLfloat cellWidth = floorWidth / columns, cellDepth = floorDepth / rows;
+    GLfloat scale = min(cellWidth / pathWidth, cellDepth / pathDepth);
+
+    vector<vec2> positions(ballCount), velocities(ballCount);
+    vector<quat> rotations(ballCount);
+    for (int i = 0; i < ballCount; i++) {
+        vec4 cellCenter(floorX0 + (i % columns + 0.5) * cellWidth, 0.0,
+                        floorZ0 + (i / columns + 0.5) * cellDepth, 0.0);
+        vec4 offset = cellCenter - scale * pathCenter;
+
+        // spread evenly but unordered, the same on every run
+        double phase = fmod(i * 0.618034, 1.0) * rollingPath.length();
+        double speed = 0.8 + 0.4 * fmod(i * 0.414214, 1.0);
+
+        RollingState state = { phase };
+        vec4 position, tangent;
+        rotations[i] = rolling_pose(state, position, tangent);
+        position = offset + scale * position;
+        positions[i] = vec2(position.x, position.z);
+        velocities[i] = speed * SIM_DISTANCE_STEP * SIM_RATE * scale
+                        * vec2(tangent.x, tangent.z);
+    }
+
+    jobSystem.start();
+    ballPhysics.init(floorX0, floorZ0, floorX1, floorZ1, scale,
+                     positions, velocities, rotations);
+}
+
+//----------------------------------------------------------------------------
+// upload_ball_instances(buffer, instances):
+//   send the ball instances of the frame to "buffer".
+//
+void upload_ball_instances(GLuint buffer, const vector<vec4>& instances)
+{
+    // Orphan the buffer rather than overwrite it: the previous frame's draw
+    // may still be reading it, and new storage does not wait for that
+    BindBuffer(GL_ARRAY_BUFFER, buffer);
+    GLsizeiptr size = sizeof(vec4) * instances.size();
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, &instances[0]);
+}
+
 //----------------------------------------------------------------------------
 // OpenGL initialization
 void init()
 {
     colorcube(cube_colorsy, cube_pointsy, verticesy, 5);
+    cube_boundsy = ComputeBoundingSphere(cube_pointsy, cube_NumVertices);
 
 #if 0 //YJC: The following is not needed
     // Create a vertex array object
@@ -386,6 +1293,7 @@ void init()
 #endif
 
     colorcube(cube_colorsx, cube_pointsx, verticesx, 1);
+    cube_boundsx = ComputeBoundingSphere(cube_pointsx, cube_NumVertices);
 
     // Create and initialize a vertex buffer object for x axis, to be used in display()
     glGenBuffers(1, &cube_bufferx);
@@ -402,6 +1310,7 @@ void init()
                     cube_colorsx);
 
     colorcube(cube_colorsz, cube_pointsz, verticesz, 4);
+    cube_boundsz = ComputeBoundingSphere(cube_pointsz, cube_NumVertices);
 
     // Create and initialize a vertex buffer object for z axis, to be used in display()
     glGenBuffers(1, &cube_bufferz);
@@ -446,6 +1355,18 @@ void init()
                     sizeof(point3) * sphere_NumVertices,
                     sizeof(vec3) * sphere_NumVertices,
                     sphere_normals_smooth);
+
+    shadow_proxy();
+
+    // Create and initialize a vertex buffer object for the shadow proxy; the
+    // normals of a unit sphere are its points
+    glGenBuffers(1, &shadowproxy_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, shadowproxy_buffer);
+
+    glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(shadowProxy_points), NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(shadowProxy_points), shadowProxy_points);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(shadowProxy_points), sizeof(shadowProxy_points),
+                    shadowProxy_points);
     
     image_set_up();
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -475,6 +1396,7 @@ void init()
                  0, GL_RGBA, GL_UNSIGNED_BYTE, stripeImage);
     
     floor();     
+    init_shadow_planes();
     // Create and initialize a vertex buffer object for floor, to be used in display()
     glGenBuffers(1, &floor_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, floor_buffer);
@@ -488,447 +1410,887 @@ void init()
     
     
  // Load shaders and create a shader program (to be used in display())
-    program = InitShader("vshader42.glsl", "fshader42.glsl");
-    
+    // Shader programs are built on first use, see use_shader_permutation()
+    init_uniform_blocks();
+
+    // Declare the passes of a frame; the pass ids are their indices
+    for (int pass = 0; pass < NumPasses; pass++)
+        renderGraph.addPass(renderPasses[pass]);
+    for (int set = 0; set < SAMPLE_QUERY_FRAMES; set++) {
+        glGenQueries(NumPasses, sampleQuerySets[set].queries);
+        sampleQuerySets[set].frame = -1;
+    }
+    frameTimer.init();
+    if (!shadowMap.init(shadowMapSize, SHADOW_MAP_UNIT))
+        exit(1);
+
     glEnable( GL_DEPTH_TEST );
     glClearColor(0.529, 0.807, 0.92, 0.0);
     glLineWidth(2.0);
+
+    init_rolling_path();
+    init_balls();
+    glGenBuffers(1, &instance_buffer);
+    glGenBuffers(1, &visible_instance_buffer);
+    ballShadows.resize(planarShadow.numPlanes());
+    for (size_t plane = 0; plane < ballShadows.size(); plane++) {
+        glGenBuffers(1, &ballShadows[plane].buffer);
+        ballShadows[plane].step = -1;
+    }
+    rolling = rolling_state_at(simStep);
+    publish_snapshot(chrono::steady_clock::now()); // the scene before the next step
+
+    InvalidateRenderState(); // the buffer set-up above bypassed the cache
 }
 
 
-void SetUp_Lighting_Uniform_Vars(mat4 mv, string object)
+// upload_uniform_block(ubo, data, size):
+//   overwrite the contents of the uniform buffer object "ubo" and count the
+//   bytes sent for the frame statistics.
+//
+void upload_uniform_block(GLuint ubo, const void* data, GLsizeiptr size)
 {
-    color4 global_ambient_product;
-    color4 positional_ambient_product;
-    color4 positional_diffuse_product;
-    color4 positional_specular_product;
-    color4 directional_ambient_product;
-    color4 directional_diffuse_product;
-    color4 directional_specular_product;
-    float material_shininess;
-    
-    bool isSphere = false;
-    bool isFloor = false;
-    bool isAxisX = false;
-    bool isAxisY = false;
-    bool isAxisZ = false;
-    bool isShadow = false;
-    
-    if (object == "sphere") {
-        isSphere = true;
-        global_ambient_product = global_light_ambient * sphere_material_ambient;
-        directional_ambient_product = directional_light_ambient * sphere_material_ambient;
-        directional_diffuse_product = directional_light_diffuse * sphere_material_diffuse;
-        directional_specular_product = directional_light_specular * sphere_material_specular;
-        material_shininess = sphere_material_shininess;
-    }
-    
-    if (object == "floor") {
-        isFloor = true;
-        global_ambient_product = global_light_ambient * floor_material_ambient;
-        directional_ambient_product = directional_light_ambient * floor_material_ambient;
-        directional_diffuse_product = directional_light_diffuse * floor_material_diffuse;
-        directional_specular_product = directional_light_specular * floor_material_specular;
-        material_shininess = floor_material_shininess;
-    }
-    
-    if (object == "sphere" && (flagPointSourceLight || flagSpotlightLight)) {
-        isSphere = true;
-        global_ambient_product = global_light_ambient * sphere_material_ambient;
-        positional_ambient_product = positional_light_ambient * sphere_material_ambient;
-        positional_diffuse_product = positional_light_diffuse * sphere_material_diffuse;
-        positional_specular_product = positional_light_specular * sphere_material_specular;
-        material_shininess = sphere_material_shininess;
-    }
-    
-    if (object == "floor" && (flagPointSourceLight || flagSpotlightLight)) {
-        isFloor = true;
-        global_ambient_product = global_light_ambient * floor_material_ambient;
-        positional_ambient_product = positional_light_ambient * floor_material_ambient;
-        positional_diffuse_product = positional_light_diffuse * floor_material_diffuse;
-        positional_specular_product = positional_light_specular * floor_material_specular;
-        material_shininess = floor_material_shininess;
-    }
-    
-    if (object == "xaxis") {
-        isAxisX = true;
-    }
-    
-    if (object == "yaxis") {
-        isAxisY = true;
-    }
-    
-    if (object == "zaxis") {
-        isAxisZ = true;
-    }
-    
-    if (object == "shadow") {
-        isShadow = true;
+    BindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    uniformUploadBytes += size;
+}
+
+//----------------------------------------------------------------------------
+// SetUp_Lighting_Uniform_Vars(mv):
+//   fill LightingBlock; mv is the viewing matrix used to bring the positional
+//   light and the spotlight direction into the eye frame. Only done when
+//   lightingDirty has been set by a callback.
+//
+void SetUp_Lighting_Uniform_Vars(mat4 mv)
+{
+    if (!lightingDirty) return;
+
+    LightingBlock block;
+
+    block.DirectionalLightDirection = directional_light_direction;
+    block.LightPosition = mv * light_position;
+    block.SpotLightDirection = mv * spotlight_direction;
+
+    block.ConstAtt = const_att;
+    block.LinearAtt = linear_att;
+    block.QuadAtt = quad_att;
+    block.ExpVal = exp_val;
+    block.CutoffAngle = cutoff_angle;
+    block.pad[0] = block.pad[1] = block.pad[2] = 0.0;
+    block.ShadowMatrix = shadowMap.eyeToMap(mv);
+
+    upload_uniform_block(lighting_ubo, &block, sizeof(block));
+    lightingDirty = false;
+}
+
+//----------------------------------------------------------------------------
+// SetUp_Material_Uniform_Vars(object):
+//   bind the MaterialBlock buffer of "object" (MAT_FLOOR, MAT_SPHERE, ...).
+//   All material blocks are rebuilt when materialDirty has been set.
+//
+void SetUp_Material_Uniform_Vars(int object)
+{
+    if (materialDirty) {
+        for (int i = 0; i < NumMaterials; i++) {
+            MaterialBlock block = MaterialBlock(); // zero-filled
+
+            color4 material_ambient, material_diffuse, material_specular;
+            bool isLit = false;
+
+            if (i == MAT_SPHERE) {
+                material_ambient = sphere_material_ambient;
+                material_diffuse = sphere_material_diffuse;
+                material_specular = sphere_material_specular;
+                block.Shininess = sphere_material_shininess;
+                isLit = true;
+            }
+
+            if (i == MAT_FLOOR) {
+                material_ambient = floor_material_ambient;
+                material_diffuse = floor_material_diffuse;
+                material_specular = floor_material_specular;
+                block.Shininess = floor_material_shininess;
+                isLit = true;
+            }
+
+            if (isLit) {
+                block.GlobalAmbientProduct = global_light_ambient * material_ambient;
+                block.DirectionalAmbientProduct = directional_light_ambient * material_ambient;
+                block.DirectionalDiffuseProduct = directional_light_diffuse * material_diffuse;
+                block.DirectionalSpecularProduct = directional_light_specular * material_specular;
+            }
+
+            if (isLit && (flagPointSourceLight || flagSpotlightLight)) {
+                block.PositionalAmbientProduct = positional_light_ambient * material_ambient;
+                block.PositionalDiffuseProduct = positional_light_diffuse * material_diffuse;
+                block.PositionalSpecularProduct = positional_light_specular * material_specular;
+            }
+
+            upload_uniform_block(material_ubo[i], &block, sizeof(block));
+        }
+        materialDirty = false;
     }
-    
-    // link variables
-    
-    glUniform4fv( glGetUniformLocation(program, "GlobalAmbientProduct"),
-          1, global_ambient_product );
-    glUniform4fv( glGetUniformLocation(program, "PositionalAmbientProduct"),
-          1, positional_ambient_product );
-    glUniform4fv( glGetUniformLocation(program, "PositionalDiffuseProduct"),
-          1, positional_diffuse_product );
-    glUniform4fv( glGetUniformLocation(program, "PositionalSpecularProduct"),
-          1, positional_specular_product );
-    glUniform4fv( glGetUniformLocation(program, "DirectionalAmbientProduct"),
-          1, directional_ambient_product );
-    glUniform4fv( glGetUniformLocation(program, "DirectionalDiffuseProduct"),
-          1, directional_diffuse_product );
-    glUniform4fv( glGetUniformLocation(program, "DirectionalSpecularProduct"),
-          1, directional_specular_product );
-
-    glUniform4fv( glGetUniformLocation(program, "SpotLightDirection"),
-             1, mv * spotlight_direction);
-    
-    glUniform4fv( glGetUniformLocation(program, "DirectionalLightDirection"),
-             1, directional_light_direction);
-    
-    glUniform4fv( glGetUniformLocation(program, "LightPosition"),
-             1, mv * light_position);
-    
-    glUniform1f(glGetUniformLocation(program, "Shininess"),
-                material_shininess );
-    
-    glUniform1f(glGetUniformLocation(program, "isSphere"),
-                isSphere );
-    glUniform1f(glGetUniformLocation(program, "isFloor"),
-                isFloor );
-    glUniform1f(glGetUniformLocation(program, "isAxisX"),
-                isAxisX );
-    glUniform1f(glGetUniformLocation(program, "isAxisY"),
-                isAxisY );
-    glUniform1f(glGetUniformLocation(program, "isAxisZ"),
-                isAxisZ );
-    glUniform1f(glGetUniformLocation(program, "isShadow"),
-                isShadow );
-    glUniform1f(glGetUniformLocation(program, "isWireframe"),
-                flagWireframe );
-    glUniform1f(glGetUniformLocation(program, "isLighting"),
-                flagLighting );
-    
-    glUniform1f(glGetUniformLocation(program, "ConstAtt"),
-                const_att);
-    glUniform1f(glGetUniformLocation(program, "LinearAtt"),
-                linear_att);
-    glUniform1f(glGetUniformLocation(program, "QuadAtt"),
-                quad_att);
-    
-    glUniform1f(glGetUniformLocation(program, "ExpVal"),
-                exp_val);
-    glUniform1f(glGetUniformLocation(program, "CutoffAngle"),
-                cutoff_angle);
-    
-    glUniform1f(glGetUniformLocation(program, "isPointSource"),
-                flagPointSourceLight);
-    glUniform1f(glGetUniformLocation(program, "isSpotlight"),
-                flagSpotlightLight);
-    
-    glUniform1i(glGetUniformLocation(program, "fogFlagIn"),
-                fogFlag);
-    
-    glUniform1i(glGetUniformLocation(program, "floortextureFlag"),
-                floortextureFlag);
-    
-    glUniform1i(glGetUniformLocation(program, "verticalFlag"),
-                verticalFlag);
-    
-    glUniform1i(glGetUniformLocation(program, "eyeFlag"),
-                eyeFlag);
-    
-    glUniform1i(glGetUniformLocation(program, "sphereCheckerFlag"),
-                sphereCheckerFlag);
-    
-    glUniform1i(glGetUniformLocation(program, "spheretextureFlag"),
-                spheretextureFlag);
-    
+
+    BindUniformBufferBase(MATERIAL_BLOCK_BINDING, material_ubo[object]);
 }
 
 //----------------------------------------------------------------------------
-// drawObj(buffer, num_vertices):
+// SetUp_Transform_Uniform_Vars(mv, p):
+//   fill TransformBlock with the model-view matrix mv, the projection matrix p
+//   and the normal matrix of mv. Nothing is sent if the block is unchanged
+//   since the previous draw (e.g. floor and axes share the same mv).
+//
+void SetUp_Transform_Uniform_Vars(mat4 mv, mat4 p)
+{
+    TransformBlock block;
+
+    block.model_view = mv;
+    block.projection = p;
+
+    mat3 normal_matrix = NormalMatrix(mv, 0);
+    for (int i = 0; i < 3; i++)
+        block.Normal_Matrix[i] = vec4(normal_matrix[i], 0.0);
+    block.MotionTime = ballMotionTime;
+    block.pad[0] = block.pad[1] = block.pad[2] = 0.0;
+
+    if (transformValid && memcmp(&block, &lastTransform, sizeof(block)) == 0)
+        return;
+
+    upload_uniform_block(transform_ubo, &block, sizeof(block));
+    lastTransform = block;
+    transformValid = true;
+}
+
+//----------------------------------------------------------------------------
+// drawObj(buffer, num_vertices, usesTexture, instanceBuffer, numInstances):
 //   draw the object that is associated with the vertex buffer object "buffer"
-//   and has "num_vertices" vertices.
+//   and has "num_vertices" vertices; numInstances > 0 draws that many copies
+//   in one instanced draw, with the rows of each (see BALL_INSTANCE_ROWS) in
+//   "instanceBuffer".
 //
-void drawObj(GLuint buffer, int num_vertices, bool usesTexture)
+void drawObj(GLuint buffer, int num_vertices, bool usesTexture,
+             GLuint instanceBuffer = 0, int numInstances = 0)
 {
     //--- Activate the vertex buffer object to be drawn ---//
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    BindBuffer(GL_ARRAY_BUFFER, buffer);
 
     /*----- Set up vertex attribute arrays for each vertex attribute -----*/
-    GLuint vPosition = glGetAttribLocation( program, "vPosition" );
+    // An attribute that a shader permutation does not use has location -1
+    GLint vPosition = glGetAttribLocation( program, "vPosition" );
     glEnableVertexAttribArray( vPosition );
     glVertexAttribPointer( vPosition, 3, GL_FLOAT, GL_FALSE, 0,
                BUFFER_OFFSET(0) );
 
-    GLuint vNormal = glGetAttribLocation( program, "vNormal" );
-    glEnableVertexAttribArray( vNormal );
-    glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE, 0,
-               BUFFER_OFFSET(sizeof(point3) * num_vertices));
-    // the offset is the (total) size of the previous vertex attribute array(s)
+    GLint vNormal = glGetAttribLocation( program, "vNormal" );
+    if (vNormal >= 0) {
+        glEnableVertexAttribArray( vNormal );
+        glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE, 0,
+                   BUFFER_OFFSET(sizeof(point3) * num_vertices));
+        // the offset is the (total) size of the previous vertex attribute array(s)
+    }
 
-    GLuint vTexCoord;
-    if (usesTexture) {
-        GLuint vTexCoord = glGetAttribLocation( program, "vTexCoord" );
+    GLint vTexCoord = -1;
+    if (usesTexture)
+        vTexCoord = glGetAttribLocation( program, "vTexCoord" );
+    if (vTexCoord >= 0) {
         glEnableVertexAttribArray( vTexCoord );
         glVertexAttribPointer( vTexCoord, 2, GL_FLOAT, GL_FALSE, 0,
                    BUFFER_OFFSET(sizeof(point3) * num_vertices * 2));
     }
     
+    // Per-instance attributes: BALL_INSTANCE_ROWS rows per instance
+    static const char* instanceRows[BALL_INSTANCE_ROWS] = {
+        "vInstanceRow0", "vInstanceRow1", "vInstanceRow2", "vInstanceMotion"
+    };
+    GLint vInstanceRow[BALL_INSTANCE_ROWS] = { -1, -1, -1, -1 };
+    if (numInstances > 0) {
+        BindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (int row = 0; row < BALL_INSTANCE_ROWS; row++) {
+            vInstanceRow[row] = glGetAttribLocation( program, instanceRows[row] );
+            if (vInstanceRow[row] < 0) continue;
+            glEnableVertexAttribArray( vInstanceRow[row] );
+            glVertexAttribPointer( vInstanceRow[row], 4, GL_FLOAT, GL_FALSE,
+                       BALL_INSTANCE_ROWS * sizeof(vec4), BUFFER_OFFSET(row * sizeof(vec4)) );
+            glVertexAttribDivisor( vInstanceRow[row], 1 );
+        }
+    }
+
     /* Draw a sequence of geometric objs (triangles) from the vertex buffer
        (using the attributes specified in each enabled vertex attribute array) */
-    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+    if (numInstances > 0)
+        glDrawArraysInstanced(GL_TRIANGLES, 0, num_vertices, numInstances);
+    else
+        glDrawArrays(GL_TRIANGLES, 0, num_vertices);
 
     /*--- Disable each vertex attribute array being enabled ---*/
     glDisableVertexAttribArray(vPosition);
-    glDisableVertexAttribArray(vNormal);
-    if (usesTexture) {
+    if (vNormal >= 0)
+        glDisableVertexAttribArray(vNormal);
+    if (vTexCoord >= 0)
         glDisableVertexAttribArray(vTexCoord);
-    }
+    for (int row = 0; row < BALL_INSTANCE_ROWS; row++)
+        if (vInstanceRow[row] >= 0) {
+            glVertexAttribDivisor(vInstanceRow[row], 0);
+            glDisableVertexAttribArray(vInstanceRow[row]);
+        }
 }
 //----------------------------------------------------------------------------
-void display( void )
+// submit_draw(pass, object, buffer, num_vertices, usesTexture, mv, polygonMode, blend,
+//             bounds, instanceBuffer, numInstances, stencilRef):
+//   push a draw of "object" onto renderQueue; nothing is drawn until
+//   execute_render_queue(). See drawObj() for instanced draws. The draw is
+//   dropped if "bounds", its bounding sphere in the world frame, is outside
+//   viewFrustum; NULL bounds are never culled. In a stencil pass, the draw
+//   marks or tests for "stencilRef".
+//
+void submit_draw(int pass, int object, GLuint buffer, int num_vertices, bool usesTexture,
+                 const mat4& mv, GLenum polygonMode, bool blend, const BoundingSphere* bounds,
+                 GLuint instanceBuffer = 0, int numInstances = 0, GLint stencilRef = 1)
 {
+    if (bounds != NULL && !viewFrustum.intersects(*bounds)) {
+        drawsCulled++;
+        return;
+    }
 
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    DrawCommand command;
+
+    command.object = object;
+    command.buffer = buffer;
+    command.numVertices = num_vertices;
+    command.usesTexture = usesTexture;
+    command.mv = mv;
+    command.instanceBuffer = instanceBuffer;
+    command.numInstances = numInstances;
+    command.stencilRef = stencilRef;
+
+    // eye-space distance to the object origin (mv may be projective, e.g. shadows)
+    vec4 origin = mv * vec4(0.0, 0.0, 0.0, 1.0);
+    GLfloat depth = (origin.w != 0.0) ? -origin.z / origin.w : 0.0;
+    command.key = MakeSortKey(pass, shader_permutation(object, numInstances > 0), blend,
+                              polygonMode, depth);
+
+    renderQueue.push(command);
+    renderGraph.addDraw(pass);
+}
 
-    glUseProgram(program); // Use the shader program
+//----------------------------------------------------------------------------
+// read_sample_queries(set):
+//   make the sample queries of "set", if it has run, the latest ones read:
+//   samplesFrame, samplesSlotName and samplesPassed. A result that is still
+//   not available is not waited for but recorded as -1.
+//
+void read_sample_queries(SampleQuerySet& set)
+{
+    if (set.frame < 0) return;
+
+    samplesFrame = set.frame;
+    samplesSlotName.assign(set.slotName, set.slotName + set.numSlots);
+    samplesPassed.assign(set.numSlots, -1);
+    for (int slot = 0; slot < set.numSlots; slot++) {
+        GLint available = 0;
+        glGetQueryObjectiv(set.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint samples;
+            glGetQueryObjectuiv(set.queries[slot], GL_QUERY_RESULT, &samples);
+            samplesPassed[slot] = samples;
+        }
+    }
+    set.frame = -1;
+}
 
-    model_view = glGetUniformLocation(program, "model_view" );
-    projection = glGetUniformLocation(program, "projection" );
+//----------------------------------------------------------------------------
+// execute_render_queue(p):
+//   compile renderGraph, then sort renderQueue and draw it slot by slot;
+//   p is the projection matrix.
+//
+void execute_render_queue(const mat4& p)
+{
+    renderGraph.compile();
+    renderQueue.remapPasses(renderGraph.slots());
+    renderQueue.sort();
+
+    // this frame's sample queries replace those of SAMPLE_QUERY_FRAMES frames ago
+    SampleQuerySet& sampleQueries = sampleQuerySets[sampleQueryFrame % SAMPLE_QUERY_FRAMES];
+    if (statsFlag == 1) {
+        read_sample_queries(sampleQueries);
+        sampleQueries.frame = sampleQueryFrame++;
+        sampleQueries.numSlots = renderGraph.numSlots();
+        for (int slot = 0; slot < renderGraph.numSlots(); slot++)
+            sampleQueries.slotName[slot] = renderGraph.slotName(slot);
+    }
 
-/*---  Set up and pass on Projection matrix to the shader ---*/
-    mat4  p = Perspective(fovy, aspect, zNear, zFar);
-    glUniformMatrix4fv(projection, 1, GL_TRUE, p); // GL_TRUE: matrix is row-major
+    int i = 0;
+    while (i < renderQueue.size()) {
+        int slot = SortKeyPass(renderQueue[i].key);
+        const RenderPassDesc& pass = renderGraph.slotState(slot);
+
+        if (statsFlag == 1)
+            frameTimer.begin(renderGraph.slotName(slot));
+
+        SetDepthTest(pass.depthTest);
+        SetDepthMask(pass.depthMask);
+        SetColorMask(pass.colorMask);
+        if (statsFlag == 1)
+            glBeginQuery(GL_SAMPLES_PASSED, sampleQueries.queries[slot]);
+
+        for ( ; i < renderQueue.size() && (int) SortKeyPass(renderQueue[i].key) == slot; i++) {
+            const DrawCommand& command = renderQueue[i];
+
+            SetBlend(SortKeyBlend(command.key), GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            SetPolygonMode(SortKeyPolygonMode(command.key));
+            if (pass.stencil == STENCIL_MARK)
+                SetStencil(true, GL_ALWAYS, command.stencilRef, GL_REPLACE);
+            else if (pass.stencil == STENCIL_ONCE)
+                SetStencil(true, GL_EQUAL, command.stencilRef, GL_ZERO);
+            else
+                SetStencil(false);
+
+            if (!use_shader_permutation(command.object, command.numInstances > 0))
+                continue;
+            SetUp_Material_Uniform_Vars(command.object);
+            SetUp_Transform_Uniform_Vars(command.mv, p);
+
+            drawObj(command.buffer, command.numVertices, command.usesTexture,
+                    command.instanceBuffer, command.numInstances);
+            drawsDrawn++;
+        }
 
-/*---  Set up and pass on Model-View matrix to the shader ---*/
-    // eye is a global variable of vec4 set to init_eye and updated by keyboard()
-    vec4    at(0.0, 0.0, 0.0, 1.0);
-    vec4    up(0.0, 1.0, 0.0, 0.0);
-    
-    mat4 sphereMat;
-    mat4 mv;
-    
-    glUniform1i( glGetUniformLocation(program, "texture_2D"), 0 );
-    glUniform1i( glGetUniformLocation(program, "texture_1D"), 1 );
-    
-    glDepthMask(GL_FALSE);
-    
-    // floor
-    
-    mv = LookAt(eye, at, up);
-    
-    SetUp_Lighting_Uniform_Vars(mv, "floor");
-    
-    glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-    mat3 normal_matrix = NormalMatrix(mv, 0);
-    glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-               1, GL_TRUE, normal_matrix );
-    
-    if (floorFlag == 1) // Filled floor
-       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    else              // Wireframe floor
-       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    drawObj(floor_buffer, floor_NumVertices, true);  // draw the floor
-
-    // for rolling segment AB
-
-    if (flagAB) {
-        vec4 A(-4.0, 1.0, 4.0, 1.0);
-        vec4 B(3.0, 1.0, -4.0, 1.0);
-        vec4 AB = B - A;
-        vec4 rotAxVec = cross(up, AB);
-
-        vec4 translationVec = normalize(AB);
-        float d = angle * 2.0 * PI / 360.0;
-        translationVec *= d;
-        translationVec += A;
-
-        sphereMat = Translate(translationVec) * Rotate(angle, rotAxVec.x, rotAxVec.y, rotAxVec.z) * totalRotation;
-
-        if (d > length(AB)) {
-            flagAB = false;
-            flagBC = true;
-            totalRotation = Rotate(angle, rotAxVec.x, rotAxVec.y, rotAxVec.z) * totalRotation;
-            angle = 0;
+        if (statsFlag == 1) {
+            glEndQuery(GL_SAMPLES_PASSED);
+            frameTimer.end();
         }
     }
+}
 
-    // for rolling segment BC
-
-    if (flagBC) {
-        vec4 B( 3.0, 1.0, -4.0, 1.0);
-        vec4 C(-3.0, 1.0, -3.0, 1.0);
-        vec4 BC = C - B;
-        vec4 rotAxVec = cross(up, BC);
+//----------------------------------------------------------------------------
+// show_frame_timing():
+//   print the CPU/GPU times of the last frame whose timer queries have been
+//   read, and show them in the window title every 15 frames.
+//
+void show_frame_timing()
+{
+    if (frameTimer.numFrames() == 0)
+        return;
+
+    const FrameTiming& timing = frameTimer.frame(frameTimer.numFrames() - 1);
+    string text;
+    char section[80];
+    for (int i = 0; i < timing.numSections; i++) {
+        snprintf(section, sizeof(section), "%s %.2f/%.2f ms  ",
+                 timing.name[i], timing.cpuMs[i], timing.gpuMs[i]);
+        text += section;
+    }
+    printf("frame %d cpu/gpu: %s\n", timing.frame, text.c_str());
 
-        vec4 translationVec = normalize(BC);
-        float d = angle * 2.0 * PI / 360.0;
-        translationVec *= d;
-        translationVec += B;
+    if (timing.frame % 15 == 0 && headlessFrames == 0)
+        glutSetWindowTitle(text.c_str());
+}
 
-        sphereMat = Translate(translationVec) * Rotate(angle, rotAxVec.x, rotAxVec.y, rotAxVec.z) * totalRotation;
+//----------------------------------------------------------------------------
+// write_frame_timing():
+//   atexit() handler; dump the timed frames to frameTimingFile.
+//
+void write_frame_timing()
+{
+    if (frameTimer.numFrames() > 0 && frameTimer.writeCsv(frameTimingFile))
+        printf("Frame timing of %d frames written to %s\n",
+               frameTimer.numFrames(), frameTimingFile);
+}
 
-        if (d > length(BC)) {
-            flagBC = false;
-            flagCA = true;
-            totalRotation = Rotate(angle, rotAxVec.x, rotAxVec.y, rotAxVec.z) * totalRotation;
-            angle = 0;
+//----------------------------------------------------------------------------
+// shadow_map_fovy():
+//   field of view of shadowMap, in degrees: the spotlight's cone, or for the
+//   point source the floor as seen from the light, with a margin.
+//
+GLfloat shadow_map_fovy()
+{
+    GLfloat halfAngle = cutoff_angle * 180.0 / PI;
+    if (flagPointSourceLight) {
+        vec3 axis = normalize(vec3(spotlight_direction.x, spotlight_direction.y,
+                                   spotlight_direction.z));
+        halfAngle = 0.0;
+        for (int i = 0; i < 4; i++) {
+            vec3 corner = normalize(floor_vertices[i] - vec3(light_position.x,
+                                    light_position.y, light_position.z));
+            halfAngle = max(halfAngle, GLfloat(acos(dot(axis, corner)) * 180.0 / PI));
         }
     }
+    return min(2.0 * halfAngle + 10.0, 150.0);
+}
 
-    // for rolling segment CA
-
-    if (flagCA) {
-        vec4 C(-3.0, 1.0, -3.0, 1.0);
-        vec4 A(-4.0, 1.0, 4.0, 1.0);
-        vec4 CA = A - C;
-        vec4 rotAxVec = cross(up, CA);
-
-        vec4 translationVec = normalize(CA);
-        float d = angle * 2.0 * PI / 360.0;
-        translationVec *= d;
-        translationVec += C;
-
-        sphereMat = Translate(translationVec) * Rotate(angle, rotAxVec.x, rotAxVec.y, rotAxVec.z) * totalRotation;
+//----------------------------------------------------------------------------
+// update_shadow_map(sphereMat, step, numInstances):
+//   render shadowMap again if the casters (the sphere with model matrix
+//   sphereMat, or the numInstances balls as of simulation step "step" moved
+//   on by ballMotionTime) or the light have moved since it was last
+//   rendered; otherwise the cached map is used as it is.
+//
+void update_shadow_map(const mat4& sphereMat, long step, int numInstances)
+{
+    if (shadowMap.setLight(light_position, spotlight_direction, shadow_map_fovy(), 1.0, 50.0))
+        lightingDirty = true;  // LightingBlock holds the eye-to-map matrix
+
+    if (numInstances > 0 ? step != shadowCasterStep || ballMotionTime != shadowCasterTime
+                         : memcmp(&sphereMat, &shadowCasterMat, sizeof(mat4)) != 0) {
+        shadowMap.invalidate();
+        shadowCasterMat = sphereMat;
+        shadowCasterStep = (numInstances > 0) ? step : -1;
+        shadowCasterTime = ballMotionTime;
+    }
 
-        if (d > length(CA)) {
-            flagCA = false;
-            flagAB = true;
-            totalRotation = Rotate(angle, rotAxVec.x, rotAxVec.y, rotAxVec.z) * totalRotation;
-            angle = 0;
-        }
+    shadowMapRendered = false;
+    if (shadowMap.valid())
+        return;
+
+    auto start = chrono::steady_clock::now();
+    if (statsFlag == 1)
+        frameTimer.begin("shadow-map");
+
+    SetDepthTest(true);
+    SetDepthMask(GL_TRUE);
+    SetColorMask(GL_FALSE);
+    SetStencil(false);
+    SetBlend(false);
+    SetPolygonMode(GL_FILL);
+
+    shadowMap.begin();
+    bool drawn = use_shader_permutation(MAT_SHADOW, numInstances > 0);
+    if (drawn) {
+        SetUp_Material_Uniform_Vars(MAT_SHADOW);
+        SetUp_Transform_Uniform_Vars(numInstances > 0 ? shadowMap.view()
+                                                      : shadowMap.view() * sphereMat,
+                                     shadowMap.projection());
+        if (flagShadowProxy)
+            drawObj(shadowproxy_buffer, shadowProxy_NumVertices, false, instance_buffer, numInstances);
+        else
+            drawObj(shadow_buffer, sphere_NumVertices, false, instance_buffer, numInstances);
     }
+    shadowMap.end();
+    if (!drawn)
+        shadowMap.invalidate();  // no casters in it: render it again next time
+
+    if (statsFlag == 1)
+        frameTimer.end();
+    shadowMapMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    shadowMapRendered = true;
+}
 
-    // shadow
-    
-    if (flagShadow) {
-        
-        if (shadowblendFlag) {
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        }
+//----------------------------------------------------------------------------
+// ball_bounds(instances, i): bounding sphere of ball i, whose instance rows
+//   start at instances[BALL_INSTANCE_ROWS * i], wherever it is drawn until
+//   the next step: grown by the distance it moves in a step.
+//
+BoundingSphere ball_bounds(const vector<vec4>& instances, int i)
+{
+    const vec4* rows = &instances[BALL_INSTANCE_ROWS * i];
+    return BoundingSphere(vec3(rows[0].w, rows[1].w, rows[2].w),
+                          ballPhysics.radius() + length(rows[3]) / SIM_RATE);
+}
 
-        SetUp_Lighting_Uniform_Vars(mv, "shadow");
+//----------------------------------------------------------------------------
+// cull_balls(snapshot, viewProjection):
+//   find the balls of "snapshot" inside viewFrustum (of "viewProjection")
+//   with ballTree, refit first if the balls have moved, and upload their
+//   instance rows to visible_instance_buffer; returns their number. Nothing
+//   is done again until the step or the view changes: between steps, the
+//   balls only move in the vertex shader.
+//
+int cull_balls(const SceneSnapshot& snapshot, const mat4& viewProjection)
+{
+    if (snapshot.step == visibleStep
+        && memcmp(&viewProjection, &visibleViewProjection, sizeof(mat4)) == 0) {
+        ballRefitMs = ballCullMs = 0.0;
+        return (int) visibleBalls.size();
+    }
 
-        mv = LookAt(eye, at, up) * Translate(-15.5, 0, -3) * shadowMat * sphereMat;
+    auto start = chrono::steady_clock::now();
+    if (statsFlag == 1)
+        frameTimer.begin("ball-cull");
 
-        glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-        normal_matrix = NormalMatrix(mv, 0);
-        glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-                   1, GL_TRUE, normal_matrix );
-        
-        if (flagWireframe) {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    if (snapshot.step != ballTreeStep) {
+        if (ballTree.count() != ballCount) {
+            vector<BoundingSphere> bounds(ballCount);
+            for (int i = 0; i < ballCount; i++)
+                bounds[i] = ball_bounds(snapshot.ballInstances, i);
+            ballTree.build(bounds);
         }
         else {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        }
-        drawObj(shadow_buffer, sphere_NumVertices, false);  // draw the shadow
-        
-        if (shadowblendFlag) {
-            glDisable(GL_BLEND);
+            for (int i = 0; i < ballCount; i++)
+                ballTree.update(i, ball_bounds(snapshot.ballInstances, i));
+            ballTree.refit();
         }
-            
+        ballTreeStep = snapshot.step;
     }
-    
-    glDepthMask(GL_TRUE);
+    auto refitted = chrono::steady_clock::now();
+
+    visibleBalls.clear();
+    ballTree.cull(viewFrustum, visibleBalls);
+    auto culled = chrono::steady_clock::now();
+
+    int numVisible = (int) visibleBalls.size();
+    visibleInstances.resize(BALL_INSTANCE_ROWS * numVisible);
+    for (int v = 0; v < numVisible; v++)
+        for (int row = 0; row < BALL_INSTANCE_ROWS; row++)
+            visibleInstances[BALL_INSTANCE_ROWS * v + row] =
+                snapshot.ballInstances[BALL_INSTANCE_ROWS * visibleBalls[v] + row];
+    if (numVisible > 0)
+        upload_ball_instances(visible_instance_buffer, visibleInstances);
+    visibleStep = snapshot.step;
+    visibleViewProjection = viewProjection;
+
+    if (statsFlag == 1)
+        frameTimer.end();
+    ballRefitMs = chrono::duration<double, milli>(refitted - start).count();
+    ballCullMs = chrono::duration<double, milli>(culled - refitted).count();
+    return numVisible;
+}
 
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+//----------------------------------------------------------------------------
+// ball_shadow_bounds(plane, instances, i, shadow):
+//   the bounds of the shadow of ball i (see ball_bounds()) on "plane" of
+//   planarShadow; false, with the ball's own bounds, if it has none.
+//
+bool ball_shadow_bounds(int plane, const vector<vec4>& instances, int i, BoundingSphere& shadow)
+{
+    BoundingSphere ball = ball_bounds(instances, i);
+    if (planarShadow.shadowBounds(plane, ball, shadow))
+        return true;
+    shadow = ball;
+    return false;
+}
 
-    // floor
-    
-    mv = LookAt(eye, at, up);
+//----------------------------------------------------------------------------
+// cull_ball_shadows(snapshot, viewProjection):
+//   for each plane of planarShadow, find the balls of "snapshot" whose
+//   shadows on it are inside viewFrustum (of "viewProjection") with the
+//   plane's tree, refit first if the balls or their projection onto the
+//   plane have moved, and upload their instance rows to the plane's buffer.
+//   As in cull_balls(), a plane is left as it is until one of these or the
+//   view changes.
+//
+void cull_ball_shadows(const SceneSnapshot& snapshot, const mat4& viewProjection)
+{
+    ballShadowRefitMs = ballShadowCullMs = 0.0;
+    bool timed = false;
+
+    for (int plane = 0; plane < planarShadow.numPlanes(); plane++) {
+        BallShadows& shadows = ballShadows[plane];
+        const mat4& projection = planarShadow.matrix(plane);
+        bool moved = snapshot.step != shadows.step
+                     || memcmp(&projection, &shadows.projection, sizeof(mat4)) != 0;
+        if (!moved && memcmp(&viewProjection, &shadows.viewProjection, sizeof(mat4)) == 0)
+            continue;
+
+        if (statsFlag == 1 && !timed) {
+            frameTimer.begin("shadow-cull");
+            timed = true;
+        }
+        auto start = chrono::steady_clock::now();
+
+        if (moved) {
+            shadows.unbounded.resize(ballCount);
+            shadows.unboundedBalls.clear();
+            BoundingSphere shadow;
+            if (shadows.tree.count() != ballCount) {
+                vector<BoundingSphere> bounds(ballCount);
+                for (int i = 0; i < ballCount; i++) {
+                    shadows.unbounded[i] = !ball_shadow_bounds(plane, snapshot.ballInstances,
+                                                                i, bounds[i]);
+                    if (shadows.unbounded[i])
+                        shadows.unboundedBalls.push_back(i);
+                }
+                shadows.tree.build(bounds);
+            }
+            else {
+                for (int i = 0; i < ballCount; i++) {
+                    shadows.unbounded[i] = !ball_shadow_bounds(plane, snapshot.ballInstances,
+                                                                i, shadow);
+                    if (shadows.unbounded[i])
+                        shadows.unboundedBalls.push_back(i);
+                    shadows.tree.update(i, shadow);
+                }
+                shadows.tree.refit();
+            }
+        }
+        auto refitted = chrono::steady_clock::now();
+
+        // what the tree finds but the unbounded balls, then all of those
+        shadows.visible.clear();
+        shadows.tree.cull(viewFrustum, shadows.visible);
+        size_t numBounded = 0;
+        for (size_t v = 0; v < shadows.visible.size(); v++)
+            if (!shadows.unbounded[shadows.visible[v]])
+                shadows.visible[numBounded++] = shadows.visible[v];
+        shadows.visible.resize(numBounded);
+        shadows.visible.insert(shadows.visible.end(), shadows.unboundedBalls.begin(),
+                               shadows.unboundedBalls.end());
+        auto culled = chrono::steady_clock::now();
+
+        int numVisible = (int) shadows.visible.size();
+        shadows.instances.resize(BALL_INSTANCE_ROWS * numVisible);
+        for (int v = 0; v < numVisible; v++)
+            for (int row = 0; row < BALL_INSTANCE_ROWS; row++)
+                shadows.instances[BALL_INSTANCE_ROWS * v + row] =
+                    snapshot.ballInstances[BALL_INSTANCE_ROWS * shadows.visible[v] + row];
+        if (numVisible > 0)
+            upload_ball_instances(shadows.buffer, shadows.instances);
+        shadows.step = snapshot.step;
+        shadows.projection = projection;
+        shadows.viewProjection = viewProjection;
+
+        ballShadowRefitMs += chrono::duration<double, milli>(refitted - start).count();
+        ballShadowCullMs += chrono::duration<double, milli>(culled - refitted).count();
+    }
+    if (timed)
+        frameTimer.end();
+}
 
-    SetUp_Lighting_Uniform_Vars(mv, "floor");
+//----------------------------------------------------------------------------
+// ball_tree_rebuilds(): rebuilds so far of ballTree and of the shadow trees.
+//
+int ball_tree_rebuilds()
+{
+    int rebuilds = ballTree.rebuilds();
+    for (size_t plane = 0; plane < ballShadows.size(); plane++)
+        rebuilds += ballShadows[plane].tree.rebuilds();
+    return rebuilds;
+}
 
-    glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-    normal_matrix = NormalMatrix(mv, 0);
-    glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-               1, GL_TRUE, normal_matrix );
+//----------------------------------------------------------------------------
+void display( void )
+{
 
-    if (floorFlag == 1) // Filled floor
-       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    else              // Wireframe floor
-       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    drawObj(floor_buffer, floor_NumVertices, true);  // draw the floor
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
 
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    uniformUploadBytes = 0;
+    drawsCulled = drawsDrawn = 0;
+    ResetRenderStateCounters();
+    if (statsFlag == 1)
+        frameTimer.beginFrame();
 
-    // sphere
-    
-    SetUp_Lighting_Uniform_Vars(mv, "sphere");
+    poll_shader_reload();
 
-    mv = LookAt(eye, at, up) * sphereMat;
+    // The whole frame is drawn from one snapshot, so that the sphere, the
+    // balls and their statistics are all of the same simulation step
+    const SceneSnapshot& snapshot = sceneSnapshots.read();
 
-    glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-    normal_matrix = NormalMatrix(mv, 0);
-    glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-               1, GL_TRUE, normal_matrix );
+/*---  Set up Projection matrix, passed on to the shader in TransformBlock ---*/
+    mat4  p = Perspective(fovy, aspect, zNear, zFar);
 
-    if (flagWireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+/*---  Set up and pass on Model-View matrix to the shader ---*/
+    // eye is a global variable of vec4 set to init_eye and updated by keyboard()
+    vec4    at(0.0, 0.0, 0.0, 1.0);
+    vec4    up(0.0, 1.0, 0.0, 0.0);
+    
+    mat4 sphereMat = rolling_matrix(rolling_frame_state(snapshot));
+    mat4 mv = LookAt(eye, at, up);
+    viewFrustum.set(p * mv);
+
+    bool shadowMapped = flagShadow && flagShadowMap;
+
+    // Many balls: the balls as of the latest step, drawn instanced, sphere
+    // and shadow alike; their model matrices are applied in the shader,
+    // which also moves them on by their velocity for the time elapsed since
+    // the step, as the sphere is moved on above.
+    // The sphere draw has the visible balls only, and the planar shadows
+    // the balls whose shadows are visible, as the shadow of a ball out of
+    // view may well be in view. The shadow map has them all: only it reads
+    // instance_buffer, which is uploaded again when it is on and the balls
+    // have moved
+    int numInstances = 0, numVisibleBalls = 0;
+    if (ballCount > 1) {
+        ballMotionTime = snapshot_fraction(snapshot) / SIM_RATE;
+        if (shadowMapped && snapshot.step != instanceStep) {
+            upload_ball_instances(instance_buffer, snapshot.ballInstances);
+            instanceStep = snapshot.step;
+        }
+        numInstances = ballCount;
+        numVisibleBalls = cull_balls(snapshot, p * mv);
     }
-    else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    mat4 sphereMv = (numInstances > 0) ? mv : mv * sphereMat;
+
+    if (shadowMapped)
+        update_shadow_map(sphereMat, snapshot.step, numInstances);
+
+    SetUp_Lighting_Uniform_Vars(mv);
+
+    renderQueue.clear();
+    renderGraph.beginFrame();
+
+    GLenum floorMode = (floorFlag == 1) ? GL_FILL : GL_LINE;      // Filled/wireframe floor
+    GLenum sphereMode = flagWireframe ? GL_LINE : GL_FILL;
+    GLenum cubeMode = (cubeFlag == 1) ? GL_FILL : GL_LINE;        // Filled/wireframe cube
+
+    // shadows follow the light; unchanged projections are not recomputed
+    planarShadow.setLight(light_position);
+    if (numInstances > 0 && flagShadow && !shadowMapped)
+        cull_ball_shadows(snapshot, p * mv);
+
+    // a filled shadow only shows the outline of the sphere: draw the proxy;
+    // a wireframe shadow shows the sphere's own mesh
+    bool shadowProxy = flagShadowProxy && !flagWireframe;
+    GLuint shadowBuffer = shadowProxy ? shadowproxy_buffer : shadow_buffer;
+    int shadowVertices = shadowProxy ? shadowProxy_NumVertices : sphere_NumVertices;
+
+    // bounds in the world frame; the balls of an instanced draw are not culled
+    BoundingSphere sphereBounds = TransformBoundingSphere(sphereMat, sphere_bounds);
+    const BoundingSphere* sphereCull = (numInstances > 0) ? NULL : &sphereBounds;
+
+    // floor and shadows, one per receiving plane, each clipped to its own
+    // receiver; the shadows are dropped by renderGraph unless presented.
+    // With the shadow map, the lit objects shade themselves
+    if (shadowMapped || flagStencilShadow)
+        submit_draw(PASS_FLOOR_STENCIL, MAT_FLOOR, floor_buffer, floor_NumVertices, true,
+                    mv, floorMode, false, &floor_bounds, 0, 0, floorShadowPlane + 1);
+    else
+        // floor without depth writes so that the shadow can be drawn onto it,
+        // then again into the depth buffer only
+        submit_draw(PASS_FLOOR, MAT_FLOOR, floor_buffer, floor_NumVertices, true,
+                    mv, floorMode, false, &floor_bounds);
+    for (int plane = 0; plane < planarShadow.numPlanes() && !shadowMapped; plane++) {
+        mat4 shadowProjection = mv * planarShadow.matrix(plane);
+        mat4 shadowMv = (numInstances > 0) ? shadowProjection : shadowProjection * sphereMat;
+        BoundingSphere shadowBounds;
+        bool bounded = sphereCull != NULL &&
+                       planarShadow.shadowBounds(plane, sphereBounds, shadowBounds);
+        int numShadows = (numInstances > 0) ? (int) ballShadows[plane].visible.size() : 0;
+        if (numInstances > 0 && numShadows == 0) {
+            drawsCulled++;
+            continue;
+        }
+        submit_draw(flagStencilShadow ? PASS_SHADOW_STENCIL : PASS_SHADOW, MAT_SHADOW,
+                    shadowBuffer, shadowVertices, false, shadowMv, sphereMode, shadowblendFlag,
+                    bounded ? &shadowBounds : NULL,
+                    (numInstances > 0) ? ballShadows[plane].buffer : 0, numShadows, plane + 1);
+    }
+    if (!flagStencilShadow && !shadowMapped) {
+        submit_draw(PASS_FLOOR_DEPTH, MAT_FLOOR, floor_buffer, floor_NumVertices, true,
+                    mv, floorMode, false, &floor_bounds);
     }
-    drawObj(sphere_buffer, sphere_NumVertices, false);  // draw the sphere
+
+    // sphere, or all the visible balls in one draw
+    if (numInstances == 0)
+        submit_draw(PASS_SPHERE, MAT_SPHERE, sphere_buffer, sphere_NumVertices, false,
+                    sphereMv, sphereMode, false, sphereCull);
+    else if (numVisibleBalls > 0)
+        submit_draw(PASS_SPHERE, MAT_SPHERE, sphere_buffer, sphere_NumVertices, false,
+                    sphereMv, sphereMode, false, NULL, visible_instance_buffer, numVisibleBalls);
+    else
+        drawsCulled++;
 
     // axes
-    
-    mv = LookAt(eye, at, up);
-
-    SetUp_Lighting_Uniform_Vars(mv, "yaxis");
-
-    glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-    normal_matrix = NormalMatrix(mv, 0);
-    glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-               1, GL_TRUE, normal_matrix );
-
-    if (cubeFlag == 1) // Filled cube
-       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    else              // Wireframe cube
-       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    drawObj(cube_buffery, cube_NumVertices, false);  // draw the y axis
-
-    SetUp_Lighting_Uniform_Vars(mv, "xaxis");
-
-    glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-    normal_matrix = NormalMatrix(mv, 0);
-    glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-               1, GL_TRUE, normal_matrix );
-
-    if (cubeFlag == 1) // Filled cube
-       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    else              // Wireframe cube
-       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    drawObj(cube_bufferx, cube_NumVertices, false);  // draw the x axis
-
-    SetUp_Lighting_Uniform_Vars(mv, "zaxis");
-
-    glUniformMatrix4fv(model_view, 1, GL_TRUE, mv); // GL_TRUE: matrix is row-major
-    normal_matrix = NormalMatrix(mv, 0);
-    glUniformMatrix3fv(glGetUniformLocation(program, "Normal_Matrix"),
-               1, GL_TRUE, normal_matrix );
-
-    if (cubeFlag == 1) // Filled cube
-       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    else              // Wireframe cube
-       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    drawObj(cube_bufferz, cube_NumVertices, false);  // draw the z axis
-    
-    glutSwapBuffers();
+    submit_draw(PASS_AXES, MAT_YAXIS, cube_buffery, cube_NumVertices, false, mv, cubeMode, false,
+                &cube_boundsy);
+    submit_draw(PASS_AXES, MAT_XAXIS, cube_bufferx, cube_NumVertices, false, mv, cubeMode, false,
+                &cube_boundsx);
+    submit_draw(PASS_AXES, MAT_ZAXIS, cube_bufferz, cube_NumVertices, false, mv, cubeMode, false,
+                &cube_boundsz);
+
+    renderGraph.present(RES_FLOOR_COLOR | RES_SCENE | (flagShadow ? RES_SHADOW : 0));
+    execute_render_queue(p);
+
+    if (statsFlag == 1) {
+        printf("uniform upload: %d bytes, state changes: %d issued, %d skipped\n",
+               uniformUploadBytes, renderStateIssued, renderStateSkipped);
+        long totalSamples = 0;
+        if (samplesFrame < 0)
+            printf("passes: not read yet");
+        else
+            printf("passes, %d frames ago:", sampleQueryFrame - 1 - samplesFrame);
+        for (int slot = 0; slot < (int) samplesPassed.size(); slot++) {
+            if (samplesPassed[slot] < 0)
+                printf(" %s (not available);", samplesSlotName[slot].c_str());
+            else
+                printf(" %s %ld samples;", samplesSlotName[slot].c_str(), samplesPassed[slot]);
+            totalSamples += max(samplesPassed[slot], 0L);
+        }
+        printf("\n%s shadow, %dx%d window: %ld samples written\n",
+               shadowMapped ? "shadow-map" : flagStencilShadow ? "stencil" : "two-pass", windowWidth, windowHeight,
+               totalSamples);
+        printf("culling: %d draws, %d culled\n", drawsDrawn, drawsCulled);
+        if (shadowMapped && shadowMapRendered)
+            printf("shadow map %dx%d: rendered in %.2f ms (CPU)\n",
+                   shadowMap.resolution(), shadowMap.resolution(), shadowMapMs);
+        else if (shadowMapped)
+            printf("shadow map %dx%d: cached\n", shadowMap.resolution(), shadowMap.resolution());
+        if (ballCount > 1) {
+            printf("physics: %d balls, %d contacts, step %.2f ms on %d threads\n",
+                   ballCount, snapshot.ballContacts, snapshot.physicsMs,
+                   jobSystem.numThreads());
+
+            // the same cull, one ball at a time, for comparison
+            auto start = chrono::steady_clock::now();
+            int linearVisible = 0;
+            for (int i = 0; i < ballCount; i++)
+                linearVisible += viewFrustum.intersects(ball_bounds(snapshot.ballInstances, i));
+            double linearMs = chrono::duration<double, milli>(
+                                  chrono::steady_clock::now() - start).count();
+            printf("bvh: %d of %d balls visible, refit %.3f ms, cull %.3f ms "
+                   "(one at a time: %d visible, %.3f ms)\n",
+                   numVisibleBalls, ballCount, ballRefitMs, ballCullMs, linearVisible, linearMs);
+            printf("bvh: %d nodes, looseness %.2f, %d rebuilds\n",
+                   ballTree.numNodes(), ballTree.looseness(), ballTree.rebuilds());
+            for (int plane = 0; plane < planarShadow.numPlanes() && flagShadow && !shadowMapped;
+                 plane++)
+                printf("shadow bvh, plane %d: %d of %d shadows visible (%d unbounded), "
+                       "%d rebuilds\n", plane, (int) ballShadows[plane].visible.size(),
+                       ballCount, (int) ballShadows[plane].unboundedBalls.size(),
+                       ballShadows[plane].tree.rebuilds());
+            if (flagShadow && !shadowMapped)
+                printf("shadow bvh: refit %.3f ms, cull %.3f ms\n",
+                       ballShadowRefitMs, ballShadowCullMs);
+        }
+        show_frame_timing();
+    }
+
+    if (statsFlag == 1) frameTimer.begin("swap");
+    if (headlessFrames > 0)
+        glFinish();  // nothing to swap; complete the frame instead
+    else {
+        auto swapStart = chrono::steady_clock::now();
+        glutSwapBuffers();
+        if (animationFlag == 1)
+            framePacer.framePresented(chrono::duration<double>(
+                                          chrono::steady_clock::now() - swapStart).count());
+    }
+    if (statsFlag == 1) frameTimer.end();
+
+    PacingReport pacing;
+    if (statsFlag == 1 && framePacer.report(pacing))
+        printf("pacing: %.1f fps (target %.0f), interval %.2f ms, jitter %.2f ms, "
+               "CPU %.0f%%, vsync %s\n", pacing.fps, framePacer.targetRate(),
+               pacing.intervalMs, pacing.jitterMs, pacing.cpuPercent,
+               pacing.vsync ? "yes" : "no");
 }
 //---------------------------------------------------------------------------
 void idle (void)
 {
-    //angle += 0.02;
-    angle += 2.0;    //YJC: change this value to adjust the sphere rotation speed.
-    glutPostRedisplay();
+    post_redisplay();  // the simulation thread has moved the sphere
+}
+//---------------------------------------------------------------------------
+// animation_timer(id): one frame of the animation; schedules the next one
+//
+void animation_timer(int id)
+{
+    if (id != animationTimer)  // stopped, or restarted since
+        return;
+    glutTimerFunc(framePacer.delayMs(), animation_timer, id);
+    idle();
+}
+//---------------------------------------------------------------------------
+void start_animation()
+{
+    simRunning = true;
+    animationTimer++;
+    framePacer.reset();
+    glutTimerFunc(0, animation_timer, animationTimer);
+}
+//---------------------------------------------------------------------------
+void stop_animation()
+{
+    simRunning = false;
+    animationTimer++;
+    framePacer.reset();
 }
 //----------------------------------------------------------------------------
 void keyboard(unsigned char key, int x, int y)
@@ -939,23 +2301,25 @@ void keyboard(unsigned char key, int x, int y)
 	    exit( EXIT_SUCCESS );
 	    break;
 
-        case 'X': eye[0] += 1.0; break;
-	case 'x': eye[0] -= 1.0; break;
-        case 'Y': eye[1] += 1.0; break;
-	case 'y': eye[1] -= 1.0; break;
-        case 'Z': eye[2] += 1.0; break;
-	case 'z': eye[2] -= 1.0; break;
+        // moving the eye moves the eye frame, in which LightingBlock holds the lights
+        case 'X': eye[0] += 1.0; lightingDirty = true; break;
+	case 'x': eye[0] -= 1.0; lightingDirty = true; break;
+        case 'Y': eye[1] += 1.0; lightingDirty = true; break;
+	case 'y': eye[1] -= 1.0; lightingDirty = true; break;
+        case 'Z': eye[2] += 1.0; lightingDirty = true; break;
+	case 'z': eye[2] -= 1.0; lightingDirty = true; break;
 
         case 'b': case 'B': // Begin rolling
             if (beginFlag == 0)  {
                 beginFlag = 1;
                 animationFlag = 1;
-                glutIdleFunc(idle);
+                start_animation();
             }
             break;
 
 	case ' ':  // reset to initial viewer/eye position
 	    eye = init_eye;
+	    lightingDirty = true;
 	    break;
             
     case 'v': verticalFlag = 1; break;
@@ -969,9 +2333,18 @@ void keyboard(unsigned char key, int x, int y)
     
     case 'e': eyeFlag = 1; break;
     case 'E': eyeFlag = 1; break;
+
+    case 'i': case 'I': // toggle printing of frame statistics (and timing in the title)
+        statsFlag = 1 - statsFlag;
+        if (statsFlag == 0)
+            glutSetWindowTitle("Color Cube");
+        break;
+
+    default:  // nothing changed: no frame to render
+        return;
     }
-    
-    glutPostRedisplay();
+
+    post_redisplay();
 }
 
 void myMouse(int button, int state, int x, int y) {
@@ -979,8 +2352,8 @@ void myMouse(int button, int state, int x, int y) {
     // if right mouse button pressed, toggle animation
     if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN && beginFlag) {
         animationFlag = 1 - animationFlag;
-        if (animationFlag == 1) glutIdleFunc(idle);
-        else                    glutIdleFunc(NULL);
+        if (animationFlag == 1) start_animation();
+        else                    stop_animation();
     }
 }
 
@@ -990,9 +2363,10 @@ void menu(int id) {
         // reset viewer position
         case 1:
             eye = init_eye;
+            lightingDirty = true;
             animationFlag = 1;
             beginFlag = 1;
-            glutIdleFunc(idle);
+            start_animation();
             break;
             
         // quit
@@ -1004,7 +2378,7 @@ void menu(int id) {
             flagWireframe = true;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 void shadow_menu(int id) {
@@ -1018,7 +2392,7 @@ void shadow_menu(int id) {
             flagShadow = false;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 void lighting_menu(int id) {
@@ -1032,7 +2406,7 @@ void lighting_menu(int id) {
             flagLighting = false;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 void shading_menu(int id) {
@@ -1041,7 +2415,7 @@ void shading_menu(int id) {
         case 1:
             flagWireframe = false;
             glGenBuffers(1, &sphere_buffer);
-            glBindBuffer(GL_ARRAY_BUFFER, sphere_buffer);
+            BindBuffer(GL_ARRAY_BUFFER, sphere_buffer);
 
             glBufferData(GL_ARRAY_BUFFER,
                          sizeof(point3)*sphere_NumVertices + sizeof(vec3)*sphere_NumVertices,
@@ -1058,7 +2432,7 @@ void shading_menu(int id) {
         case 2:
             flagWireframe = false;
             glGenBuffers(1, &sphere_buffer);
-            glBindBuffer(GL_ARRAY_BUFFER, sphere_buffer);
+            BindBuffer(GL_ARRAY_BUFFER, sphere_buffer);
 
             glBufferData(GL_ARRAY_BUFFER,
                          sizeof(point3)*sphere_NumVertices + sizeof(vec3)*sphere_NumVertices,
@@ -1071,7 +2445,7 @@ void shading_menu(int id) {
                             sphere_normals_smooth);
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 void lightsource_menu(int id) {
@@ -1088,7 +2462,8 @@ void lightsource_menu(int id) {
             flagPointSourceLight = true;
             break;
     }
-    glutPostRedisplay();
+    materialDirty = true;
+    post_redisplay();
 }
 
 void fog_menu(int id) {
@@ -1110,9 +2485,49 @@ void fog_menu(int id) {
             fogFlag = 3;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
+}
+
+void shadowmethod_menu(int id) {
+    switch(id) {
+            
+        case 1:
+            flagStencilShadow = true;
+            flagShadowMap = false;
+            break;
+            
+        case 2:
+            flagStencilShadow = false;
+            flagShadowMap = false;
+            break;
+
+        case 3:
+            flagShadowMap = true;
+            break;
+    }
+    post_redisplay();
+}
+
+void shadowmapsize_menu(int id) {
+    shadowMapSize = id;
+    shadowMap.setResolution(shadowMapSize);
+    post_redisplay();
 }
 
+void shadowgeometry_menu(int id) {
+    switch(id) {
+            
+        case 1:
+            flagShadowProxy = true;
+            break;
+            
+        case 2:
+            flagShadowProxy = false;
+            break;
+    }
+    shadowMap.invalidate();  // other casters
+    post_redisplay();
+}
 void shadowblend_menu(int id) {
     switch(id) {
             
@@ -1125,7 +2540,7 @@ void shadowblend_menu(int id) {
             shadowblendFlag = false;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 void floortexture_menu(int id) {
@@ -1140,7 +2555,7 @@ void floortexture_menu(int id) {
             floortextureFlag = 0;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 void spheretexture_menu(int id) {
@@ -1161,7 +2576,7 @@ void spheretexture_menu(int id) {
             spheretextureFlag = 0;
             break;
     }
-    glutPostRedisplay();
+    post_redisplay();
 }
 
 //----------------------------------------------------------------------------
@@ -1169,20 +2584,21 @@ void reshape(int width, int height)
 {
     glViewport(0, 0, width, height);
     aspect = (GLfloat) width  / (GLfloat) height;
-    glutPostRedisplay();
+    windowWidth = width;
+    windowHeight = height;
+    post_redisplay();
 }
 //----------------------------------------------------------------------------
-void fileinput()
+// load_sphere_file(filename):
+//   read the sphere triangles of "filename" into sphere_points; returns
+//   false if the file cannot be opened.
+//
+bool load_sphere_file(const string& filename)
 {
     //try to open file
-    cout << "Enter filename: ";
-    string filename;
-    cin >> filename;
     ifstream ifs(filename);
-    if (!ifs) {
-        cout << "Failed to open file" << endl;
-        exit(1);
-    }
+    if (!ifs)
+        return false;
     
     //read data into vector
     int num_triangles;
@@ -1203,16 +2619,175 @@ void fileinput()
     }
     
     sphere_NumVertices = index;
-    
+    sphere_bounds = ComputeBoundingSphere(sphere_points, sphere_NumVertices);
+    return true;
 }
 //----------------------------------------------------------------------------
+void fileinput()
+{
+    cout << "Enter filename: ";
+    string filename;
+    cin >> filename;
+    if (!load_sphere_file(filename)) {
+        cout << "Failed to open file" << endl;
+        exit(1);
+    }
+}
+//----------------------------------------------------------------------------
+// init_headless():
+//   create the offscreen context of headlessWidth x headlessHeight and
+//   initialize the scene, with the sphere already loaded and rolling.
+//   headlessFrames must be set (> 0).
+//
+bool init_headless()
+{
+    if (!CreateHeadlessContext(headlessWidth, headlessHeight))
+        return false;
+    printf("Renderer: %s\n", glGetString(GL_RENDERER));
+    printf("OpenGL version supported %s\n", glGetString(GL_VERSION));
+
+    // Core profile needs a bound VAO; harmless otherwise
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    reshape(headlessWidth, headlessHeight);
+    init();
+
+    // roll from the start, as after pressing 'b', or from step headlessStart
+    beginFlag = 1;
+    animationFlag = 1;
+    simulate_steps(headlessStart);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// headless_frame():
+//   advance the simulation by one fixed step and render one frame offscreen;
+//   returns the time taken in ms, up to the completion of the frame.
+//
+double headless_frame()
+{
+    auto start = chrono::steady_clock::now();
+    simulate_steps(1);
+    display();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+//----------------------------------------------------------------------------
+// check_shadow_proxy():
+//   render the current frame again with the shadow of the proxy and of the
+//   sphere mesh, and report how many pixels differ between the two.
+//
+void check_shadow_proxy()
+{
+    int pixels = headlessWidth * headlessHeight;
+    vector<GLubyte> image[2];
+    bool proxy = flagShadowProxy;
+
+    for (int k = 0; k < 2; k++) {
+        flagShadowProxy = (k == 0);
+        display();
+        image[k].resize(4 * pixels);
+        glReadPixels(0, 0, headlessWidth, headlessHeight, GL_RGBA, GL_UNSIGNED_BYTE, &image[k][0]);
+    }
+    flagShadowProxy = proxy;
+
+    int differ = 0, maxDifference = 0;
+    for (int i = 0; i < pixels; i++) {
+        int difference = 0;
+        for (int c = 0; c < 3; c++)
+            difference = max(difference, abs(image[0][4 * i + c] - image[1][4 * i + c]));
+        if (difference > 0)
+            differ++;
+        maxDifference = max(maxDifference, difference);
+    }
+    printf("Shadow proxy (%d vertices) vs sphere mesh (%d vertices): "
+           "%d of %d pixels differ, by up to %d\n", shadowProxy_NumVertices,
+           sphere_NumVertices, differ, pixels, maxDifference);
+}
+
+//----------------------------------------------------------------------------
+// run_headless():
+//   render headlessFrames frames of the rolling sphere offscreen, print the
+//   frame time statistics and return the exit status.
+//
+int run_headless()
+{
+    fileinput();
+    if (!init_headless())
+        return 1;
+
+    vector<double> frameMs;
+    auto runStart = chrono::steady_clock::now();
+    for (int frame = 0; frame < headlessFrames; frame++)
+        frameMs.push_back(headless_frame());
+    double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - runStart).count();
+
+    double minMs = frameMs[0], maxMs = frameMs[0];
+    for (size_t i = 1; i < frameMs.size(); i++) {
+        minMs = min(minMs, frameMs[i]);
+        maxMs = max(maxMs, frameMs[i]);
+    }
+    printf("%d frames at %dx%d in %.1f ms: mean %.3f ms, min %.3f ms, max %.3f ms, %.1f fps\n",
+           headlessFrames, headlessWidth, headlessHeight, totalMs, totalMs / headlessFrames,
+           minMs, maxMs, 1000.0 * headlessFrames / totalMs);
+
+    if (headlessOutput != NULL && SaveFramebufferPPM(headlessOutput, headlessWidth, headlessHeight))
+        printf("Last frame written to %s\n", headlessOutput);
+    if (headlessShadowCheck)
+        check_shadow_proxy();
+    write_frame_timing();
+
+    DestroyHeadlessContext();
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+#ifndef ROLLINGBALL_BENCH // the benchmark has its own main(), see bench/
 int main( int argc, char **argv )
 {
+    // --headless N [--size WxH] [--output file.ppm] [--stats] [--start STEP]
+    //            [--shadow-check]:
+    //   no window, see run_headless()
+    // --fps N: animation frame rate, 0 for as fast as possible
+    // --path file: roll along the path in "file" (see RollingPath.h)
+    // --balls N: roll N balls that collide with each other
+    // --shadow-map [--shadow-map-size N]: spotlight shadows from an N x N
+    //   shadow map (default 1024)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+            headlessFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &headlessWidth, &headlessHeight);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            headlessOutput = argv[++i];
+        else if (strcmp(argv[i], "--stats") == 0)
+            statsFlag = 1;
+        else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+            headlessStart = atol(argv[++i]);
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            framePacer.setTargetRate(atof(argv[++i]));
+        else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+            rollingPathFile = argv[++i];
+        else if (strcmp(argv[i], "--shadow-check") == 0)
+            headlessShadowCheck = true;
+        else if (strcmp(argv[i], "--balls") == 0 && i + 1 < argc)
+            ballCount = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--shadow-map") == 0)
+            flagShadowMap = true;
+        else if (strcmp(argv[i], "--shadow-map-size") == 0 && i + 1 < argc)
+            shadowMapSize = max(16, atoi(argv[++i]));
+    }
+    if (headlessFrames > 0)
+        return run_headless();
+
+    EnableShaderBuilderThread();
     glutInit(&argc, argv);
 #ifdef __APPLE__ // Enable core profile of OpenGL 3.2 on macOS.
-    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_3_2_CORE_PROFILE);
+    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL | GLUT_3_2_CORE_PROFILE);
 #else
-    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
+    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);
 #endif
     glutInitWindowSize(512, 512);
     glutCreateWindow("Color Cube");
@@ -1272,6 +2847,21 @@ int main( int argc, char **argv )
     glutAddMenuEntry("Yes", 1);
     glutAddMenuEntry("No", 2);
     
+    int shadowmethod_submenu = glutCreateMenu(shadowmethod_menu);
+    glutAddMenuEntry("Stencil (floor drawn once)", 1);
+    glutAddMenuEntry("Two floor passes", 2);
+    glutAddMenuEntry("Shadow map (spotlight)", 3);
+
+    int shadowmapsize_submenu = glutCreateMenu(shadowmapsize_menu);
+    glutAddMenuEntry("512 x 512", 512);
+    glutAddMenuEntry("1024 x 1024", 1024);
+    glutAddMenuEntry("2048 x 2048", 2048);
+    glutAddMenuEntry("4096 x 4096", 4096);
+    
+    int shadowgeometry_submenu = glutCreateMenu(shadowgeometry_menu);
+    glutAddMenuEntry("Low-poly proxy", 1);
+    glutAddMenuEntry("Sphere mesh", 2);
+
     int floortexture_submenu = glutCreateMenu(floortexture_menu);
     glutAddMenuEntry("Yes", 1);
     glutAddMenuEntry("No", 2);
@@ -1292,11 +2882,24 @@ int main( int argc, char **argv )
     glutAddSubMenu("Light Source", lightsource_submenu);
     glutAddSubMenu("Fog Options", fog_submenu);
     glutAddSubMenu("Blending Shadow", shadowblend_submenu);
+    glutAddSubMenu("Shadow Method", shadowmethod_submenu);
+    glutAddSubMenu("Shadow Geometry", shadowgeometry_submenu);
+    glutAddSubMenu("Shadow Map Size", shadowmapsize_submenu);
     glutAddSubMenu("Texture Mapped Ground", floortexture_submenu);
     glutAddSubMenu("Texture Mapped Sphere", spheretexture_submenu);
     glutAttachMenu(GLUT_LEFT_BUTTON);
 
     init();
+    atexit(write_frame_timing);
+    start_simulation_thread();
+
+    if (StartShaderWatcher(shaderFiles, 2)) {
+        shaderWatching = true;
+        InitShaderBuilder();
+        glutTimerFunc(250, shader_watch_timer, 0);
+    }
+
     glutMainLoop();
     return 0;
 }
+#endif // ROLLINGBALL_BENCH
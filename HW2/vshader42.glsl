@@ -7,6 +7,18 @@
  *
  * - This vertex shader uses the Model-View and Projection matrices passed
  *   on from the OpenGL program as uniform variables of type mat4.
+ *
+ * - The object type and the menu options are not uniforms: the OpenGL
+ *   program compiles one specialized shader program per combination in use
+ *   and injects the corresponding #defines right after the #version line:
+ *     IS_SPHERE, IS_FLOOR, IS_AXIS_X, IS_AXIS_Y, IS_AXIS_Z, IS_SHADOW
+ *     IS_LIGHTING (lit colour; off for wireframe or unlit sphere/floor)
+ *     IS_POINT_SOURCE, IS_SPOTLIGHT
+ *     SPHERE_TEXTURE_FLAG, SPHERE_CHECKER_FLAG, VERTICAL_FLAG, EYE_FLAG
+ *     FLOOR_TEXTURE_FLAG, FOG_FLAG (0..3)
+ *     IS_INSTANCED (one draw of many spheres or of their shadows, see below)
+ *     IS_SHADOW_MAPPED (the positional light is left to the fragment
+ *       shader, which tests it against the shadow map; see fshader42.glsl)
  ***************************/
 
 #version 150  // YJC: Comment/un-comment this line to resolve compilation errors
@@ -19,195 +31,193 @@ out vec4 color;
 out float z;
 out vec2 texCoord;
 
-uniform bool isPointSource;
-uniform bool isSpotlight;
+#if defined(IS_SHADOW_MAPPED)
+out vec3 eyePosition;    // for the positional light, lit per fragment
+out vec3 eyeNormal;
+out vec4 shadowCoord;    // shadow map coordinates (divide by w)
+#endif
+
+#if defined(IS_INSTANCED)
+// Model matrix of each instance, object frame to world frame: its first
+// three rows (the fourth is 0 0 0 1). model_view is then the view alone,
+// after the projection onto the floor for shadows.
+in vec4 vInstanceRow0;
+in vec4 vInstanceRow1;
+in vec4 vInstanceRow2;
+// Velocity of the instance, a ball rolling on the floor without slipping;
+// it is moved on by MotionTime seconds from where the rows put it.
+in vec4 vInstanceMotion;
+#endif
+
+// Per-frame lighting state; re-uploaded only when a menu/keyboard callback
+// changes it.
+layout(std140) uniform LightingBlock {
+    vec4 DirectionalLightDirection;
+    vec4 LightPosition;
+    vec4 SpotLightDirection;
+    float ConstAtt;
+    float LinearAtt;
+    float QuadAtt;
+    float ExpVal;
+    float CutoffAngle;
+    layout(row_major) mat4 ShadowMatrix;  // eye frame to shadow map
+};
+
+// Per-material state: light * material products.
+layout(std140) uniform MaterialBlock {
+    vec4 GlobalAmbientProduct;
+    vec4 PositionalAmbientProduct, PositionalDiffuseProduct, PositionalSpecularProduct;
+    vec4 DirectionalAmbientProduct, DirectionalDiffuseProduct, DirectionalSpecularProduct;
+    float Shininess;
+};
+
+// Per-draw transforms, sent row-major as stored by mat-yjc-new.h
+layout(std140, row_major) uniform TransformBlock {
+    mat4 model_view;
+    mat4 projection;
+    mat3 Normal_Matrix;
+    float MotionTime;    // seconds since the instance rows were written
+};
 
-uniform vec4 GlobalAmbientProduct, PositionalAmbientProduct, PositionalDiffuseProduct, PositionalSpecularProduct;
-uniform vec4 DirectionalAmbientProduct, DirectionalDiffuseProduct, DirectionalSpecularProduct;
-uniform mat3 Normal_Matrix;
-uniform vec4 SpotLightDirection;
-uniform vec4 DirectionalLightDirection;
-uniform vec4 LightPosition;
-uniform float Shininess;
+void main() 
+{
+    vec4 vPosition4 = vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);
 
-uniform mat4 model_view;
-uniform mat4 projection;
+#if defined(IS_INSTANCED)
+    vec4 vModel = vec4(dot(vInstanceRow0, vPosition4), dot(vInstanceRow1, vPosition4),
+                       dot(vInstanceRow2, vPosition4), 1.0);
+    vec3 vModelNormal = vec3(dot(vInstanceRow0.xyz, vNormal), dot(vInstanceRow1.xyz, vNormal),
+                             dot(vInstanceRow2.xyz, vNormal));
+
+    // Roll the ball on about its center: by the distance over the radius,
+    // about the axis on the floor across its motion
+    vec3 center = vec3(vInstanceRow0.w, vInstanceRow1.w, vInstanceRow2.w);
+    float speed = length(vInstanceMotion.xyz);
+    if (speed > 0.0) {
+        vec3 k = vec3(vInstanceMotion.z, 0.0, -vInstanceMotion.x) / speed;
+        float angle = speed * MotionTime / length(vInstanceRow0.xyz);
+        float c = cos(angle), s = sin(angle);
+        vec3 r = vModel.xyz - center;
+        r = r * c + cross(k, r) * s + k * dot(k, r) * (1.0 - c);
+        vModelNormal = vModelNormal * c + cross(k, vModelNormal) * s
+                       + k * dot(k, vModelNormal) * (1.0 - c);
+        vModel.xyz = center + r + vInstanceMotion.xyz * MotionTime;
+    }
+#else
+    vec4 vModel = vPosition4;
+    vec3 vModelNormal = vNormal;
+#endif
 
-uniform bool isSphere;
-uniform bool isFloor;
-uniform bool isAxisX;
-uniform bool isAxisY;
-uniform bool isAxisZ;
-uniform bool isShadow;
+#if defined(IS_LIGHTING)
 
-uniform float ConstAtt;
-uniform float LinearAtt;
-uniform float QuadAtt;
+    // directional light
 
-uniform float ExpVal;
-uniform float CutoffAngle;
+    vec3 pos = (model_view * vModel).xyz;
 
-uniform bool isWireframe;
-uniform bool isLighting;
+    vec3 L = normalize( -DirectionalLightDirection.xyz );
+    vec3 E = normalize( -pos );
+    vec3 H = normalize( L + E );
 
-uniform int fogFlagIn;
-flat out int fogFlagOut;
-flat out int isFloorFragment;
-flat out int isSphereFragment;
+    vec3 N = normalize(Normal_Matrix * vModelNormal);
 
-uniform int verticalFlag;
-uniform int eyeFlag;
-uniform int sphereCheckerFlag;
-flat out int sphereCheckerFlagFragment;
-uniform int spheretextureFlag;
+    if ( dot(N, E) < 0 ) N = -N;
 
-void main() 
-{
-    vec4 vPosition4 = vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);
-    
-    if (isSphere || isFloor) {
-        
-        // directional light
-        
-        vec3 pos = (model_view * vPosition4).xyz;
-        
-        vec3 L = normalize( -DirectionalLightDirection.xyz );
-        vec3 E = normalize( -pos );
-        vec3 H = normalize( L + E );
-
-        vec3 N = normalize(Normal_Matrix * vNormal);
-
-        if ( dot(N, E) < 0 ) N = -N;
-        
-        float attenuation = 1.0;
-        
-        vec4 global = GlobalAmbientProduct;
-        
-        vec4 ambient = DirectionalAmbientProduct;
-
-        float d = max( dot(L, N), 0.0 );
-        vec4  diffuse = d * DirectionalDiffuseProduct;
-
-        float s = pow( max(dot(N, H), 0.0), Shininess );
-        vec4  specular = s * DirectionalSpecularProduct;
-
-        if( dot(L, N) < 0.0 ) {
-            specular = vec4(0.0, 0.0, 0.0, 1.0);
-        }
-        
-        color = global + (attenuation * (ambient + diffuse + specular));
-        
-        // positional light
-        
-        L = normalize( LightPosition.xyz - pos );
-        H = normalize( L + E );
-        
-        float dist = abs(distance(LightPosition.xyz, pos));
-        
-        if (isPointSource) {
-            attenuation = 1.0 / (ConstAtt + (LinearAtt * dist) + (QuadAtt * (dist * dist)));
-        }
-        if (isSpotlight) {
-            if (dot(normalize(SpotLightDirection.xyz), -L) < cos(CutoffAngle)) {
-                attenuation = 0.0;
-            }
-            else {
-                attenuation = pow(dot(normalize(SpotLightDirection.xyz), -L), ExpVal) / (ConstAtt + (LinearAtt * dist) + (QuadAtt * (dist * dist)));
-            }
-        }
-        
-        ambient = PositionalAmbientProduct;
-
-        d = max( dot(L, N), 0.0 );
-        diffuse = d * PositionalDiffuseProduct;
-
-        s = pow( max(dot(N, H), 0.0), Shininess );
-        specular = s * PositionalSpecularProduct;
-
-        if( dot(L, N) < 0.0 ) {
-            specular = vec4(0.0, 0.0, 0.0, 1.0);
-        }
-        
-        color += (attenuation * (ambient + diffuse + specular));
-    }
+    float attenuation = 1.0;
 
-    if (isAxisX) {
-        color = vec4(1.0, 0.0, 0.0, 1.0);
-    }
+    vec4 global = GlobalAmbientProduct;
 
-    if (isAxisY) {
-        color = vec4(1.0, 0.0, 1.0, 1.0);
-    }
+    vec4 ambient = DirectionalAmbientProduct;
 
-    if (isAxisZ) {
-        color = vec4(0.0, 0.0, 1.0, 1.0);
-    }
+    float d = max( dot(L, N), 0.0 );
+    vec4  diffuse = d * DirectionalDiffuseProduct;
 
-    if (isShadow) {
-        color = vec4(0.25, 0.25, 0.25, 0.65);
-    }
-    
-    if (isSphere && (isWireframe || !isLighting)) {
-        color = vec4(1.0, 0.84, 0.0, 1.0);
-    }
-    
-    if (isFloor && !isLighting) {
-        color = vec4(0.0, 1.0, 0.0, 1.0);
+    float s = pow( max(dot(N, H), 0.0), Shininess );
+    vec4  specular = s * DirectionalSpecularProduct;
+
+    if( dot(L, N) < 0.0 ) {
+        specular = vec4(0.0, 0.0, 0.0, 1.0);
     }
-    
-    gl_Position = projection * model_view * vPosition4;
-    
-    vec4 pos = projection * model_view * vPosition4;
-    vec4 pos2 = model_view * vPosition4;
-    z = pos.z;
-    
-    fogFlagOut = fogFlagIn;
-    if (isFloor) {
-        texCoord = vTexCoord;
-        isFloorFragment = 1;
+
+    color = global + (attenuation * (ambient + diffuse + specular));
+
+    // positional light
+
+#if defined(IS_SHADOW_MAPPED)
+    eyePosition = pos;
+    eyeNormal = N;
+    shadowCoord = ShadowMatrix * vec4(pos, 1.0);
+#else
+    L = normalize( LightPosition.xyz - pos );
+    H = normalize( L + E );
+
+    float dist = abs(distance(LightPosition.xyz, pos));
+
+#if defined(IS_POINT_SOURCE)
+    attenuation = 1.0 / (ConstAtt + (LinearAtt * dist) + (QuadAtt * (dist * dist)));
+#endif
+#if defined(IS_SPOTLIGHT)
+    if (dot(normalize(SpotLightDirection.xyz), -L) < cos(CutoffAngle)) {
+        attenuation = 0.0;
     }
     else {
-        isFloorFragment = 0;
-    }
-    if (isSphere && sphereCheckerFlag == 0 && spheretextureFlag == 1) {
-        isSphereFragment = 1;
-        
-        if (verticalFlag == 1 && eyeFlag == 0) {
-            texCoord[0] = 2.5 * vPosition.x;
-        }
-        if (verticalFlag == 0 && eyeFlag == 0) {
-            texCoord[0] = 1.5 * (vPosition.x + vPosition.y + vPosition.z);
-        }
-        if (verticalFlag == 1 && eyeFlag == 1) {
-            texCoord[0] = 2.5 * pos2.x;
-        }
-        if (verticalFlag == 0 && eyeFlag == 1) {
-            texCoord[0] = 1.5 * (pos2.x + pos2.y + pos2.z);
-        }
+        attenuation = pow(dot(normalize(SpotLightDirection.xyz), -L), ExpVal) / (ConstAtt + (LinearAtt * dist) + (QuadAtt * (dist * dist)));
     }
-    if (isSphere && sphereCheckerFlag == 1 && spheretextureFlag == 1) {
-        isSphereFragment = 1;
-        
-        if (verticalFlag == 1 && eyeFlag == 0) {
-            texCoord[0] = 0.75 * (vPosition.x + 1);
-            texCoord[1] = 0.75 * (vPosition.y + 1);
-        }
-        if (verticalFlag == 0 && eyeFlag == 0) {
-            texCoord[0] = 0.45 * (vPosition.x + vPosition.y + vPosition.z);
-            texCoord[1] = 0.45 * (vPosition.x - vPosition.y + vPosition.z);
-        }
-        if (verticalFlag == 1 && eyeFlag == 1) {
-            texCoord[0] = 0.75 * (pos2.x + 1);
-            texCoord[1] = 0.75 * (pos2.y + 1);
-        }
-        if (verticalFlag == 0 && eyeFlag == 1) {
-            texCoord[0] = 0.45 * (pos2.x + pos2.y + pos2.z);
-            texCoord[1] = 0.45 * (pos2.x - pos2.y + pos2.z);
-        }
-    }
-    if (!isSphere) {
-        isSphereFragment = 0;
+#endif
+
+    ambient = PositionalAmbientProduct;
+
+    d = max( dot(L, N), 0.0 );
+    diffuse = d * PositionalDiffuseProduct;
+
+    s = pow( max(dot(N, H), 0.0), Shininess );
+    specular = s * PositionalSpecularProduct;
+
+    if( dot(L, N) < 0.0 ) {
+        specular = vec4(0.0, 0.0, 0.0, 1.0);
     }
-    
-    sphereCheckerFlagFragment = sphereCheckerFlag;
+
+    color += (attenuation * (ambient + diffuse + specular));
+#endif
+
+#elif defined(IS_SPHERE)       // wireframe or lighting disabled
+    color = vec4(1.0, 0.84, 0.0, 1.0);
+#elif defined(IS_FLOOR)        // lighting disabled
+    color = vec4(0.0, 1.0, 0.0, 1.0);
+#elif defined(IS_AXIS_X)
+    color = vec4(1.0, 0.0, 0.0, 1.0);
+#elif defined(IS_AXIS_Y)
+    color = vec4(1.0, 0.0, 1.0, 1.0);
+#elif defined(IS_AXIS_Z)
+    color = vec4(0.0, 0.0, 1.0, 1.0);
+#elif defined(IS_SHADOW)
+    color = vec4(0.25, 0.25, 0.25, 0.65);
+#endif
+
+    gl_Position = projection * model_view * vModel;
+
+    vec4 pos2 = model_view * vModel;
+    z = gl_Position.z;
+
+#if defined(IS_FLOOR)
+    texCoord = vTexCoord;
+#endif
+
+#if defined(IS_SPHERE) && defined(SPHERE_TEXTURE_FLAG)
+#if defined(EYE_FLAG)
+    vec4 tp = pos2;         // texture coordinates from the eye frame
+#else
+    vec4 tp = vPosition4;   // texture coordinates from the object frame
+#endif
+#if defined(SPHERE_CHECKER_FLAG) && defined(VERTICAL_FLAG)
+    texCoord[0] = 0.75 * (tp.x + 1);
+    texCoord[1] = 0.75 * (tp.y + 1);
+#elif defined(SPHERE_CHECKER_FLAG)
+    texCoord[0] = 0.45 * (tp.x + tp.y + tp.z);
+    texCoord[1] = 0.45 * (tp.x - tp.y + tp.z);
+#elif defined(VERTICAL_FLAG)
+    texCoord[0] = 2.5 * tp.x;
+#else
+    texCoord[0] = 1.5 * (tp.x + tp.y + tp.z);
+#endif
+#endif
 } 